@@ -0,0 +1,229 @@
+// Single threaded OrderBook microbenchmarks, no threads, queues or output involved: the sink just counts events.
+//
+//   add           resting orders spread over --levels price levels per side, nothing crosses
+//   amend         shrinks each of them in place (keeps time priority), in random order
+//   reprice       moves each of them one level further from the middle (a relocate), in random order
+//   cancel        cancels all of them again, in random order
+//   cross/N       one order sweeping N price levels of --depth orders each (ns per sweep and per fill)
+//   deep          --deep orders resting over 10000 levels per side, then a mix of adds, cancels and small crosses
+//
+// Every workload runs against tree backed books and against dense price ladders.
+//
+// Usage: book_bench [--orders=N] [--levels=N] [--depth=N] [--deep=N]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <random>
+#include <vector>
+
+#include "../src/OrderBook.hpp"
+
+namespace {
+
+struct CountingSink {
+    uint64_t added = 0, executed = 0, deleted = 0, amended = 0, removed = 0;
+    uint64_t checksum = 0;
+
+    void OrderAdded(uint32_t id, const char*, uint32_t price, uint32_t count, bool, int64_t) {
+        ++added;
+        checksum += id ^ price ^ count;
+    }
+    void OrderExecuted(uint32_t resting_id, uint32_t, uint32_t, uint32_t price, uint32_t count, int64_t) {
+        ++executed;
+        checksum += resting_id ^ price ^ count;
+    }
+    void OrderDeleted(uint32_t id, bool ok, int64_t) {
+        ++deleted;
+        checksum += id + ok;
+    }
+    void OrderAmended(uint32_t id, bool ok, uint32_t price, uint32_t count, int64_t) {
+        amended += ok;
+        checksum += id ^ price ^ count;
+    }
+    void OrderRemoved(uint32_t id) {
+        ++removed;
+        checksum += id;
+    }
+    void LevelChanged(bool, uint32_t price, uint64_t quantity, uint32_t orders, int64_t) {
+        checksum += price ^ quantity ^ orders;
+    }
+};
+
+using Book = OrderBook<CountingSink>;
+
+struct Options {
+    size_t orders = 1000000;
+    uint32_t levels = 1000;
+    uint32_t depth = 10;
+    size_t deep = 1000000;
+};
+
+constexpr uint32_t Mid = 100000;
+
+double now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Summed over every book at the end, so none of the work can be optimized away
+uint64_t totalChecksum = 0;
+
+void report(const char* config, const char* name, size_t ops, double secs, const char* unit = "op") {
+    printf("%-7s %-10s %10zu x %-6s %9.1f ns/%-6s %7.2f M/s\n", config, name, ops, unit, secs * 1e9 / ops, unit, ops / secs / 1e6);
+}
+
+// Ladder covering every price the workloads use, or none for the tree
+std::optional<LadderConfig> ladderFor(bool ladder) {
+    if (!ladder)
+        return std::nullopt;
+    return LadderConfig{Mid - 20000, 1, 40000};
+}
+
+void addAndCancel(const Options& opt, bool ladder, const char* config) {
+    CountingSink sink;
+    Book book("BENCH", sink, ladderFor(ladder));
+    std::mt19937 rng(1);
+    std::vector<uint32_t> prices(opt.orders);
+    for (auto& p : prices)
+        p = 1 + rng() % opt.levels;
+
+    double t0 = now();
+    for (size_t i = 0; i < opt.orders; ++i) {
+        uint32_t id = static_cast<uint32_t>(i + 1);
+        if (i & 1)
+            book.buy(id, Mid - prices[i], 10, 0);
+        else
+            book.sell(id, Mid + prices[i], 10, 0);
+    }
+    report(config, "add", opt.orders, now() - t0);
+
+    std::vector<uint32_t> ids(opt.orders);
+    for (size_t i = 0; i < opt.orders; ++i)
+        ids[i] = static_cast<uint32_t>(i + 1);
+    std::shuffle(ids.begin(), ids.end(), rng);
+    // Ids are odd on the sell side, even on the buy side
+    auto priceOf = [&](uint32_t id, uint32_t away) { return id & 1 ? Mid + prices[id - 1] + away : Mid - prices[id - 1] - away; };
+    t0 = now();
+    for (uint32_t id : ids)
+        book.amend(id, priceOf(id, 0), 5, 0);
+    report(config, "amend", opt.orders, now() - t0);
+
+    std::shuffle(ids.begin(), ids.end(), rng);
+    t0 = now();
+    for (uint32_t id : ids)
+        book.amend(id, priceOf(id, 1), 5, 0);
+    report(config, "reprice", opt.orders, now() - t0);
+    if (sink.amended != 2 * opt.orders)
+        fprintf(stderr, "book_bench: %llu of %zu amends accepted\n", (unsigned long long)sink.amended, 2 * opt.orders);
+
+    std::shuffle(ids.begin(), ids.end(), rng);
+    t0 = now();
+    for (uint32_t id : ids)
+        book.cancel(id, 0);
+    report(config, "cancel", opt.orders, now() - t0);
+    if (book.liveOrders() != 0 || sink.deleted != opt.orders)
+        fprintf(stderr, "book_bench: add/cancel left %zu orders\n", book.liveOrders());
+    totalChecksum += sink.checksum;
+}
+
+void cross(const Options& opt, bool ladder, const char* config, uint32_t levels) {
+    CountingSink sink;
+    Book book("BENCH", sink, ladderFor(ladder));
+    uint32_t id = 1;
+    size_t sweeps = std::max<size_t>(1, opt.orders / (levels * opt.depth));
+    double busy = 0;
+    for (size_t s = 0; s < sweeps; ++s) {
+        for (uint32_t l = 0; l < levels; ++l)
+            for (uint32_t d = 0; d < opt.depth; ++d)
+                book.sell(id++, Mid + l, 10, 0);
+        double t0 = now();
+        book.buy(id++, Mid + levels, levels * opt.depth * 10, 0);
+        busy += now() - t0;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "cross/%u", levels);
+    report(config, name, sweeps, busy, "sweep");
+    report(config, name, sweeps * levels * opt.depth, busy, "fill");
+    if (sink.executed != sweeps * levels * opt.depth)
+        fprintf(stderr, "book_bench: %s expected %zu fills, got %llu\n", name, sweeps * levels * opt.depth, (unsigned long long)sink.executed);
+    totalChecksum += sink.checksum;
+}
+
+void deep(const Options& opt, bool ladder, const char* config) {
+    CountingSink sink;
+    Book book("BENCH", sink, ladderFor(ladder));
+    std::mt19937 rng(2);
+    const uint32_t levels = 10000;
+    std::vector<uint32_t> live;
+    uint32_t id = 1;
+    for (size_t i = 0; i < opt.deep; ++i, ++id) {
+        if (i & 1)
+            book.buy(id, Mid - 1 - rng() % levels, 1 + rng() % 100, 0);
+        else
+            book.sell(id, Mid + 1 + rng() % levels, 1 + rng() % 100, 0);
+        live.push_back(id);
+    }
+
+    double t0 = now();
+    size_t ops = opt.orders;
+    for (size_t i = 0; i < ops; ++i) {
+        unsigned r = rng() % 100;
+        if (r < 40 && !live.empty()) {
+            size_t at = rng() % live.size();
+            book.cancel(live[at], 0);
+            live[at] = live.back();
+            live.pop_back();
+        } else if (r < 50) {
+            // Small aggressive order, takes out the top of the other side
+            if (r & 1)
+                book.buy(id++, Mid + 1 + rng() % 5, 50, 0);
+            else
+                book.sell(id++, Mid - 1 - rng() % 5, 50, 0);
+        } else {
+            if (r & 1)
+                book.buy(id, Mid - 1 - rng() % levels, 1 + rng() % 100, 0);
+            else
+                book.sell(id, Mid + 1 + rng() % levels, 1 + rng() % 100, 0);
+            live.push_back(id++);
+        }
+    }
+    report(config, "deep", ops, now() - t0);
+    totalChecksum += sink.checksum;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options opt;
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--orders=", 9) == 0)
+            opt.orders = strtoull(argv[i] + 9, nullptr, 10);
+        else if (strncmp(argv[i], "--levels=", 9) == 0 && atoi(argv[i] + 9) > 0 && atoi(argv[i] + 9) < 20000)
+            opt.levels = atoi(argv[i] + 9);
+        else if (strncmp(argv[i], "--depth=", 8) == 0 && atoi(argv[i] + 8) > 0)
+            opt.depth = atoi(argv[i] + 8);
+        else if (strncmp(argv[i], "--deep=", 7) == 0)
+            opt.deep = strtoull(argv[i] + 7, nullptr, 10);
+        else {
+            fprintf(stderr, "Usage: %s [--orders=N] [--levels=N] [--depth=N] [--deep=N]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (opt.orders == 0) {
+        fprintf(stderr, "book_bench: --orders must be > 0\n");
+        return 1;
+    }
+
+    for (bool ladder : {false, true}) {
+        const char* config = ladder ? "ladder" : "tree";
+        addAndCancel(opt, ladder, config);
+        for (uint32_t levels : {1u, 10u, 100u})
+            cross(opt, ladder, config, levels);
+        deep(opt, ladder, config);
+    }
+    printf("checksum %llu\n", (unsigned long long)totalChecksum);
+    return 0;
+}
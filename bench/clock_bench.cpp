@@ -0,0 +1,135 @@
+// Cost of a timestamp: Clock::nanoseconds() (TSC when invariant) against clock_gettime and steady_clock::now(),
+// stamped back to back on one thread and from --threads threads at once (the TSC anchor is shared). A bare rdtsc is
+// timed too, what's left above it is the conversion (under a hypervisor rdtsc itself can cost 20 ns or more).
+//
+// Then follows the clock against CLOCK_MONOTONIC for --seconds, across anchor moves, and reports how far apart they
+// got and whether any thread ever saw its own stamps go backwards.
+//
+// Usage: clock_bench [--calls=N] [--threads=N] [--seconds=N]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "../src/Clock.hpp"
+
+namespace {
+
+struct Options {
+    size_t calls = 20000000;
+    unsigned threads = 2;
+    unsigned seconds = 3;
+};
+
+double now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Summed and printed, so no stamp can be optimized away
+std::atomic<uint64_t> totalChecksum{0};
+
+template <typename Stamp>
+double nsPerCall(size_t calls, Stamp&& stamp) {
+    uint64_t checksum = 0;
+    double t0 = now();
+    for (size_t i = 0; i < calls; ++i)
+        checksum += static_cast<uint64_t>(stamp());
+    double secs = now() - t0;
+    totalChecksum += checksum;
+    return secs * 1e9 / calls;
+}
+
+template <typename Stamp>
+void single(const char* name, size_t calls, Stamp&& stamp) {
+    printf("%-16s 1 thread  %6.1f ns/stamp\n", name, nsPerCall(calls, stamp));
+}
+
+template <typename Stamp>
+void concurrent(const char* name, const Options& opt, Stamp&& stamp) {
+    std::vector<double> ns(opt.threads);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < opt.threads; ++t)
+        threads.emplace_back([&, t] { ns[t] = nsPerCall(opt.calls / opt.threads, stamp); });
+    for (auto& th : threads)
+        th.join();
+    printf("%-16s %u thread%s %6.1f ns/stamp (slowest thread)\n", name, opt.threads, opt.threads > 1 ? "s" : " ", *std::max_element(ns.begin(), ns.end()));
+}
+
+// Stamps continuously for the given time, comparing with CLOCK_MONOTONIC every so often
+void follow(const Options& opt) {
+    std::atomic<bool> backwards{false};
+    std::atomic<int64_t> worst{0};
+    auto run = [&] {
+        int64_t last = Clock::nanoseconds();
+        int64_t until = Clock::monotonic() + int64_t(opt.seconds) * 1000000000;
+        for (uint64_t i = 1; ; ++i) {
+            int64_t t = Clock::nanoseconds();
+            if (t < last)
+                backwards = true;
+            last = t;
+            if (i % 4096 == 0) {
+                // Bracket a monotonic reading with two stamps, the distance to the nearer one is the disagreement
+                int64_t before = Clock::nanoseconds();
+                int64_t mono = Clock::monotonic();
+                int64_t after = Clock::nanoseconds();
+                int64_t off = mono < before ? before - mono : mono > after ? mono - after : 0;
+                int64_t w = worst.load();
+                while (off > w && !worst.compare_exchange_weak(w, off)) { }
+                last = after;
+                if (mono >= until)
+                    break;
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < opt.threads; ++t)
+        threads.emplace_back(run);
+    for (auto& th : threads)
+        th.join();
+    printf("over %u s: at most %lld ns from CLOCK_MONOTONIC, %s\n", opt.seconds, (long long)worst.load(),
+           backwards ? "WENT BACKWARDS within a thread" : "never went backwards within a thread");
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options opt;
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--calls=", 8) == 0 && atoll(argv[i] + 8) > 0)
+            opt.calls = strtoull(argv[i] + 8, nullptr, 10);
+        else if (strncmp(argv[i], "--threads=", 10) == 0 && atoi(argv[i] + 10) > 0)
+            opt.threads = atoi(argv[i] + 10);
+        else if (strncmp(argv[i], "--seconds=", 10) == 0)
+            opt.seconds = atoi(argv[i] + 10);
+        else {
+            fprintf(stderr, "Usage: %s [--calls=N] [--threads=N] [--seconds=N]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    printf("clock source: %s", Clock::source());
+    if (Clock::tscGhz() > 0)
+        printf(" at %.4f GHz", Clock::tscGhz());
+    printf("\n");
+
+    auto clock = [] { return Clock::nanoseconds(); };
+    auto gettime = [] { return Clock::monotonic(); };
+    auto steady = [] { return std::chrono::steady_clock::now().time_since_epoch().count(); };
+    single("Clock", opt.calls, clock);
+    single("clock_gettime", opt.calls, gettime);
+    single("steady_clock", opt.calls, steady);
+#if defined(__x86_64__)
+    single("rdtsc", opt.calls, [] { return __rdtsc(); });
+#endif
+    concurrent("Clock", opt, clock);
+    concurrent("clock_gettime", opt, gettime);
+    if (opt.seconds > 0)
+        follow(opt);
+    printf("checksum %llu\n", (unsigned long long)totalChecksum.load());
+    return 0;
+}
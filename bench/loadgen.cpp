@@ -0,0 +1,404 @@
+// Synthetic order flow against a whole engine: sustained throughput and per message latency.
+//
+// The engine runs inside this process with --output=binary going into a pipe, and a reader thread matches every
+// output event back to the command that caused it. A message's latency is from just before it was sent to when its
+// first event (B/S added or E executed for a new order, X for a cancel) was read back out of the pipe.
+//
+//   socket  clients connect over a Unix socket like ./client would (text lines, or frames with --binary),
+//           so the numbers include io.cpp / the reactor
+//   inproc  client threads call Engine::processClientCommand directly, no socket and no parsing
+//
+// All order flow is generated up front from --seed, the same options always send the same messages.
+//
+// Usage: loadgen [--mode=socket|inproc|both] [--orders=N] [--clients=N] [--instruments=N] [--mix=ADD:CANCEL:CROSS]
+//                [--prices=normal|uniform] [--width=N] [--rate=N] [--batch=N] [--binary] [--seed=N]
+//                [--reactor[=N]] [--wait=spin|yield|futex] [--cancel-priority]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../src/engine.hpp"
+#include "../src/LatencyStats.hpp"
+#include "../src/WireProtocol.hpp"
+
+namespace {
+
+struct Options {
+    std::string mode = "both";
+    size_t orders = 500000;      // messages in total, over all clients
+    unsigned clients = 4;
+    unsigned instruments = 8;
+    unsigned addPct = 60, cancelPct = 30, crossPct = 10;
+    bool normalPrices = true;
+    uint32_t width = 50;         // passive orders rest up to this many ticks away from the middle
+    double rate = 0;             // messages per second per client, 0 = as fast as possible
+    size_t batch = 16;           // socket mode: messages per write
+    bool binary = false;
+    uint32_t seed = 1;
+    size_t ioThreads = 0;
+    WaitStrategy wait = WaitStrategy::SpinFutex;
+    bool cancelPriority = false;
+};
+
+constexpr uint32_t MidPrice = 10000;
+
+// Order ids are dense, client c sends c + 1, c + 1 + clients, ... so every message's send time has a fixed slot
+std::vector<std::vector<ClientCommand>> generate(const Options& opt) {
+    std::vector<std::vector<ClientCommand>> flows(opt.clients);
+    size_t perClient = opt.orders / opt.clients;
+    for (unsigned c = 0; c < opt.clients; ++c) {
+        std::mt19937 rng(opt.seed * 7919 + c);
+        std::normal_distribution<double> normal(0, opt.width / 3.0);
+        std::vector<uint32_t> live;
+        uint32_t nextId = c + 1;
+        auto& flow = flows[c];
+        flow.reserve(perClient);
+        for (size_t i = 0; i < perClient; ++i) {
+            ClientCommand cmd {};
+            unsigned r = rng() % 100;
+            if (r < opt.cancelPct && !live.empty()) {
+                size_t at = rng() % live.size();
+                cmd.type = input_cancel;
+                cmd.order_id = live[at];
+                live[at] = live.back();
+                live.pop_back();
+                flow.push_back(cmd);
+                continue;
+            }
+            bool buy = rng() & 1;
+            cmd.type = buy ? input_buy : input_sell;
+            cmd.order_id = nextId;
+            nextId += opt.clients;
+            std::string symbol = "SYM" + std::to_string(rng() % opt.instruments);
+            memcpy(cmd.instrument, symbol.data(), std::min<size_t>(symbol.size(), 8));
+            if (r < opt.cancelPct + opt.crossPct) {
+                // Priced through the whole passive range of the other side
+                cmd.price = buy ? MidPrice + opt.width : MidPrice - opt.width;
+                cmd.count = 1 + rng() % 300;
+            } else {
+                uint32_t away = opt.normalPrices ? std::min<uint32_t>(std::abs(normal(rng)), opt.width - 1)
+                                                 : rng() % opt.width;
+                cmd.price = buy ? MidPrice - 1 - away : MidPrice + 1 + away;
+                cmd.count = 1 + rng() % 100;
+                live.push_back(cmd.order_id);
+            }
+            flow.push_back(cmd);
+        }
+    }
+    return flows;
+}
+
+size_t messageCount(const std::vector<std::vector<ClientCommand>>& flows) {
+    size_t n = 0;
+    for (auto& f : flows)
+        n += f.size();
+    return n;
+}
+
+// Send stamps of new orders and cancels by order id, and the reader thread that turns output events into latencies
+class Tracker {
+public:
+    explicit Tracker(size_t maxId) : addSent(maxId + 1), cancelSent(maxId + 1), addSeen(maxId + 1), cancelSeen(maxId + 1) { }
+
+    void sent(const ClientCommand& cmd, int64_t ts) {
+        (cmd.type == input_cancel ? cancelSent : addSent)[cmd.order_id].store(ts, std::memory_order_relaxed);
+    }
+
+    // Reads events off fd until `expected` messages have been answered, returns when the last one came in
+    int64_t collect(int fd, size_t expected) {
+        std::vector<char> buf(1 << 20);
+        size_t have = 0;
+        size_t answered = 0;
+        int64_t last = 0;
+        while (answered < expected) {
+            ssize_t n = read(fd, buf.data() + have, buf.size() - have);
+            if (n <= 0) {
+                perror("loadgen: output pipe");
+                break;
+            }
+            have += n;
+            last = getCurrentTimestamp();
+            size_t whole = have / sizeof(OutputEvent);
+            for (size_t i = 0; i < whole; ++i) {
+                OutputEvent e;
+                memcpy(&e, buf.data() + i * sizeof(OutputEvent), sizeof(e));
+                answered += answer(e, last);
+            }
+            have -= whole * sizeof(OutputEvent);
+            memmove(buf.data(), buf.data() + whole * sizeof(OutputEvent), have);
+        }
+        return last;
+    }
+
+    LatencyHistogram latency;
+    // Cancels only, also in latency
+    LatencyHistogram cancelLatency;
+
+private:
+    int answer(const OutputEvent& e, int64_t now) {
+        uint32_t id = e.type == 'E' ? e.new_id : e.id;
+        bool cancel = e.type == 'X';
+        std::vector<char>& seen = cancel ? cancelSeen : addSeen;
+        // An E for the resting side, or a second event for the same message
+        if (id >= seen.size() || seen[id])
+            return 0;
+        int64_t sentAt = (cancel ? cancelSent : addSent)[id].load(std::memory_order_relaxed);
+        if (sentAt == 0)
+            return 0;
+        seen[id] = 1;
+        latency.record(LatencyStats::delta(sentAt, now));
+        if (cancel)
+            cancelLatency.record(LatencyStats::delta(sentAt, now));
+        return 1;
+    }
+
+    std::vector<std::atomic<int64_t>> addSent;
+    std::vector<std::atomic<int64_t>> cancelSent;
+    std::vector<char> addSeen;
+    std::vector<char> cancelSeen;
+};
+
+// Sleeps until message i of a client paced at rate is due
+void pace(double rate, int64_t start, size_t i) {
+    if (rate <= 0)
+        return;
+    int64_t due = start + static_cast<int64_t>(i * 1e9 / rate);
+    int64_t now = getCurrentTimestamp();
+    if (due > now)
+        std::this_thread::sleep_for(std::chrono::nanoseconds(due - now));
+}
+
+void sendSocket(const Options& opt, const char* path, const std::vector<ClientCommand>& flow, Tracker& tracker) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (fd == -1 || connect(fd, (const struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        perror("loadgen: connect");
+        exit(1);
+    }
+    auto writeAll = [fd](const char* p, size_t n) {
+        while (n > 0) {
+            ssize_t w = write(fd, p, n);
+            if (w < 0) {
+                perror("loadgen: write");
+                exit(1);
+            }
+            p += w;
+            n -= w;
+        }
+    };
+    if (opt.binary)
+        writeAll(reinterpret_cast<const char*>(&BinaryHandshake), 1);
+
+    std::vector<char> out;
+    int64_t start = getCurrentTimestamp();
+    for (size_t i = 0; i < flow.size(); i += opt.batch) {
+        pace(opt.rate, start, i);
+        size_t end = std::min(flow.size(), i + opt.batch);
+        out.clear();
+        for (size_t j = i; j < end; ++j) {
+            const ClientCommand& cmd = flow[j];
+            char msg[64];
+            size_t n;
+            if (opt.binary)
+                n = encodeCommand(cmd, msg);
+            else if (cmd.type == input_cancel)
+                n = snprintf(msg, sizeof(msg), "C %u\n", cmd.order_id);
+            else
+                n = snprintf(msg, sizeof(msg), "%c %u %s %u %u\n", char(cmd.type), cmd.order_id, cmd.instrument, cmd.price, cmd.count);
+            out.insert(out.end(), msg, msg + n);
+        }
+        int64_t now = getCurrentTimestamp();
+        for (size_t j = i; j < end; ++j)
+            tracker.sent(flow[j], now);
+        writeAll(out.data(), out.size());
+    }
+    close(fd);
+}
+
+void sendInProcess(const Options& opt, Engine& engine, const std::vector<ClientCommand>& flow, Tracker& tracker) {
+    int64_t start = getCurrentTimestamp();
+    for (size_t i = 0; i < flow.size(); ++i) {
+        pace(opt.rate, start, i);
+        tracker.sent(flow[i], getCurrentTimestamp());
+        engine.processClientCommand(flow[i]);
+    }
+}
+
+void run(const Options& opt, bool overSocket) {
+    auto flows = generate(opt);
+    size_t total = messageCount(flows);
+    Tracker tracker(opt.orders + opt.clients + 1);
+
+    int pipeFds[2];
+    if (pipe(pipeFds) != 0) {
+        perror("loadgen: pipe");
+        exit(1);
+    }
+    fcntl(pipeFds[0], F_SETPIPE_SZ, 1 << 20);
+
+    EngineConfig config;
+    config.outputFormat = OutputPublisher::Format::Binary;
+    config.outputFd = pipeFds[1];
+    config.waitStrategy = opt.wait;
+    config.cancelPriority = opt.cancelPriority;
+    config.ioThreads = opt.ioThreads;
+    // Not deleted: detached connection threads may still be on their way out when the run is over
+    Engine* engine = new Engine(config);
+
+    std::string path = "/tmp/loadgen." + std::to_string(getpid()) + ".sock";
+    int listenFd = -1;
+    std::thread acceptor;
+    if (overSocket) {
+        unlink(path.c_str());
+        listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        struct sockaddr_un addr {};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        if (listenFd == -1 || bind(listenFd, (const struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listenFd, 64) != 0) {
+            perror("loadgen: listen");
+            exit(1);
+        }
+        acceptor = std::thread([&] {
+            for (unsigned c = 0; c < opt.clients; ++c) {
+                int fd = accept(listenFd, nullptr, nullptr);
+                if (fd == -1) {
+                    perror("loadgen: accept");
+                    return;
+                }
+                engine->accept(ClientConnection(fd));
+            }
+        });
+    }
+
+    int64_t done = 0;
+    std::thread reader([&] { done = tracker.collect(pipeFds[0], total); });
+
+    int64_t start = getCurrentTimestamp();
+    std::vector<std::thread> clients;
+    for (unsigned c = 0; c < opt.clients; ++c)
+        clients.emplace_back([&, c] {
+            if (overSocket)
+                sendSocket(opt, path.c_str(), flows[c], tracker);
+            else
+                sendInProcess(opt, *engine, flows[c], tracker);
+        });
+    for (auto& t : clients)
+        t.join();
+    reader.join();
+    if (acceptor.joinable())
+        acceptor.join();
+    engine->flushOutput();
+    if (listenFd != -1) {
+        close(listenFd);
+        unlink(path.c_str());
+    }
+
+    double secs = (done - start) / 1e9;
+    LatencyHistogram::Snapshot lat = tracker.latency.snapshot();
+    printf("%-6s%s clients=%u instruments=%u mix=%u:%u:%u  %zu msgs in %.3f s  %8.0f msg/s  "
+           "p50 %8llu ns  p99 %8llu ns  p99.9 %8llu ns  max %9llu ns\n",
+           overSocket ? "socket" : "inproc", overSocket && opt.binary ? "(bin)" : "", opt.clients, opt.instruments,
+           opt.addPct, opt.cancelPct, opt.crossPct, lat.total, secs, lat.total / secs,
+           (unsigned long long)lat.percentile(0.5), (unsigned long long)lat.percentile(0.99),
+           (unsigned long long)lat.percentile(0.999), (unsigned long long)lat.max);
+    LatencyHistogram::Snapshot cancels = tracker.cancelLatency.snapshot();
+    printf("%-6s%s cancels only%s: %zu msgs  p50 %8llu ns  p99 %8llu ns  p99.9 %8llu ns  max %9llu ns\n",
+           overSocket ? "socket" : "inproc", overSocket && opt.binary ? "(bin)" : "", opt.cancelPriority ? ", priority lane" : "",
+           size_t(cancels.total), (unsigned long long)cancels.percentile(0.5), (unsigned long long)cancels.percentile(0.99),
+           (unsigned long long)cancels.percentile(0.999), (unsigned long long)cancels.max);
+    if (lat.total != total)
+        fprintf(stderr, "loadgen: only %zu of %zu messages answered\n", size_t(lat.total), total);
+}
+
+void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [--mode=socket|inproc|both] [--orders=N] [--clients=N] [--instruments=N] [--mix=ADD:CANCEL:CROSS]\n"
+            "          [--prices=normal|uniform] [--width=N] [--rate=N] [--batch=N] [--binary] [--seed=N]\n"
+            "          [--reactor[=N]] [--wait=spin|yield|futex] [--cancel-priority]\n",
+            prog);
+}
+
+bool parse(int argc, char* argv[], Options& opt) {
+    for (int i = 1; i < argc; ++i) {
+        const char* a = argv[i];
+        auto val = [a](const char* name) -> const char* {
+            size_t n = strlen(name);
+            return strncmp(a, name, n) == 0 ? a + n : nullptr;
+        };
+        const char* v;
+        if ((v = val("--mode=")) && (!strcmp(v, "socket") || !strcmp(v, "inproc") || !strcmp(v, "both")))
+            opt.mode = v;
+        else if ((v = val("--orders=")))
+            opt.orders = strtoull(v, nullptr, 10);
+        else if ((v = val("--clients=")) && atoi(v) > 0)
+            opt.clients = atoi(v);
+        else if ((v = val("--instruments=")) && atoi(v) > 0 && atoi(v) <= 100000)
+            opt.instruments = atoi(v);
+        else if ((v = val("--mix="))) {
+            if (sscanf(v, "%u:%u:%u", &opt.addPct, &opt.cancelPct, &opt.crossPct) != 3 ||
+                opt.addPct + opt.cancelPct + opt.crossPct != 100)
+                return false;
+        } else if ((v = val("--prices=")) && (!strcmp(v, "normal") || !strcmp(v, "uniform")))
+            opt.normalPrices = !strcmp(v, "normal");
+        else if ((v = val("--width=")) && atoi(v) > 0 && atoi(v) < int(MidPrice))
+            opt.width = atoi(v);
+        else if ((v = val("--rate=")))
+            opt.rate = atof(v);
+        else if ((v = val("--batch=")) && atoi(v) > 0)
+            opt.batch = atoi(v);
+        else if (!strcmp(a, "--binary"))
+            opt.binary = true;
+        else if ((v = val("--seed=")))
+            opt.seed = strtoul(v, nullptr, 10);
+        else if (!strcmp(a, "--reactor"))
+            opt.ioThreads = 2;
+        else if (!strcmp(a, "--cancel-priority"))
+            opt.cancelPriority = true;
+        else if ((v = val("--reactor=")) && atoi(v) > 0)
+            opt.ioThreads = atoi(v);
+        else if ((v = val("--wait="))) {
+            if (!strcmp(v, "spin"))
+                opt.wait = WaitStrategy::BusySpin;
+            else if (!strcmp(v, "yield"))
+                opt.wait = WaitStrategy::SpinYield;
+            else if (!strcmp(v, "futex"))
+                opt.wait = WaitStrategy::SpinFutex;
+            else
+                return false;
+        } else
+            return false;
+    }
+    return opt.clients <= opt.orders;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options opt;
+    if (!parse(argc, argv, opt)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (opt.mode != "inproc")
+        run(opt, true);
+    if (opt.mode != "socket")
+        run(opt, false);
+    return 0;
+}
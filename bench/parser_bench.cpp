@@ -0,0 +1,178 @@
+// Text command parsing throughput: the hand written parseCommand vs the sscanf based parser it replaced.
+//
+// Before timing anything, both parsers are run over a set of malformed / odd inputs plus random mutations
+// of valid lines, and must agree on accept / reject and on the parsed fields.
+//
+// Also times decoding the same commands from binary frames (WireProtocol.hpp).
+//
+// Usage: parser_bench [--lines=N]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../src/CommandParser.hpp"
+#include "../src/WireProtocol.hpp"
+#include "../src/io.hpp"
+
+namespace {
+
+// The parser from before, kept here as the reference (plus amends, which came later, in the same sscanf terms)
+bool legacyParse(const char* buffer, ClientCommand& read_into) {
+    read_into = ClientCommand{};
+    char typeChar;
+    if (sscanf(buffer, " %c", &typeChar) != 1)
+        return false;
+    if (typeChar == 'B' || typeChar == 'S') {
+        if (sscanf(buffer, " %c %u %8s %u %u", &typeChar, &read_into.order_id, read_into.instrument, &read_into.price, &read_into.count) != 5)
+            return false;
+    } else if (typeChar == 'C') {
+        if (sscanf(buffer, " %c %u", &typeChar, &read_into.order_id) != 2)
+            return false;
+    } else if (typeChar == 'M') {
+        if (sscanf(buffer, " %c %u %u %u", &typeChar, &read_into.order_id, &read_into.price, &read_into.count) != 4)
+            return false;
+    } else {
+        return false;
+    }
+    read_into.type = static_cast<CommandType>(typeChar);
+    return true;
+}
+
+bool sameCommand(const ClientCommand& a, const ClientCommand& b) {
+    return a.type == b.type && a.order_id == b.order_id && a.price == b.price && a.count == b.count &&
+           strcmp(a.instrument, b.instrument) == 0;
+}
+
+int conformance(std::mt19937& rng) {
+    std::vector<std::string> cases = {
+        "B 1 AAPL 100 10", "S 2 GOOG 5 1", "C 7", "  B 1 AAPL 1 1", "B1 AAPL 2 3", "C7", "C", "C x",
+        "B 1 AAPL 100", "B 1", "X 1 A 1 1", "", "   ", "\t\r", "B 1 ABCDEFGH 1 1", "B 1 ABCDEFGHI 1 1",
+        "B 1 ABCDEFGH12 5", "B +1 AAPL +2 +3", "B -1 AAPL -2 -3", "B 1 AAPL 4294967296 1",
+        "B 99999999999999999999999 AAPL 1 1", "B 1 AAPL 1 1 trailing", "B 1 AAPL 1 +", "b 1 AAPL 1 1",
+        "S\t3\tMSFT\t7\t8", "C 4294967295", "B 1 AAPL 1 1\n", "C -",
+        "M 1 100 5", "M1 2 3", "M 1 100", "M 1 AAPL 100 5", "M -1 +2 0", "M 1 2 3 trailing",
+    };
+    const char alphabet[] = "BSCM 0123456789+-AZ\t";
+    int failures = 0;
+    for (int i = 0; i < 200000; ++i) {
+        std::string line = cases[i % 5];
+        // a few random edits of a valid line
+        int edits = 1 + rng() % 3;
+        for (int e = 0; e < edits && !line.empty(); ++e) {
+            size_t at = rng() % line.size();
+            switch (rng() % 3) {
+                case 0: line[at] = alphabet[rng() % (sizeof(alphabet) - 1)]; break;
+                case 1: line.erase(at, 1); break;
+                case 2: line.insert(at, 1, alphabet[rng() % (sizeof(alphabet) - 1)]); break;
+            }
+        }
+        cases.push_back(line);
+    }
+    for (const std::string& c : cases) {
+        ClientCommand a {}, b {};
+        bool legacyOk = legacyParse(c.c_str(), a);
+        bool newOk = parseCommand(c.c_str(), b) == ParseError::None;
+        if (legacyOk != newOk || (legacyOk && !sameCommand(a, b))) {
+            if (++failures <= 10)
+                fprintf(stderr, "MISMATCH on \"%s\": sscanf %s, parseCommand %s\n", c.c_str(),
+                        legacyOk ? "accepts" : "rejects", newOk ? "accepts" : "rejects");
+        }
+    }
+    printf("conformance: %zu inputs, %d mismatches\n", cases.size(), failures);
+    return failures;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t lines = 2000000;
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--lines=", 8) == 0)
+            lines = strtoull(argv[i] + 8, nullptr, 10);
+        else {
+            fprintf(stderr, "Usage: %s [--lines=N]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    std::mt19937 rng(42);
+    if (conformance(rng) != 0)
+        return 1;
+
+    // Realistic mix: mostly new orders, some cancels, as one NUL separated block like RecvBuffer hands them out
+    const char* symbols[] = {"AAPL", "GOOG", "MSFT", "TSLA", "ABCDEFGH"};
+    std::vector<char> block;
+    std::vector<size_t> starts;
+    char line[64];
+    for (size_t i = 0; i < lines; ++i) {
+        int n;
+        if (rng() % 5 == 0)
+            n = snprintf(line, sizeof(line), "C %u", unsigned(rng() % 1000000));
+        else
+            n = snprintf(line, sizeof(line), "%c %zu %s %u %u", rng() % 2 ? 'B' : 'S', i, symbols[rng() % 5],
+                         unsigned(9000 + rng() % 2000), unsigned(1 + rng() % 500));
+        starts.push_back(block.size());
+        block.insert(block.end(), line, line + n + 1);
+    }
+
+    auto time = [&](const char* name, auto&& parse) {
+        ClientCommand cmd {};
+        uint64_t checksum = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        for (size_t s : starts) {
+            parse(block.data() + s, cmd);
+            checksum += cmd.order_id + cmd.price;
+        }
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        printf("%-12s %7.1f M lines/s  %7.1f MB/s  %6.1f ns/line  (checksum %llu)\n", name, lines / secs / 1e6,
+               block.size() / secs / 1e6, secs * 1e9 / lines, (unsigned long long)checksum);
+    };
+    time("sscanf", [](const char* l, ClientCommand& c) { legacyParse(l, c); });
+    time("parseCommand", [](const char* l, ClientCommand& c) { parseCommand(l, c); });
+
+    // The same commands as one stream of binary frames
+    std::vector<char> frames;
+    {
+        ClientCommand cmd {};
+        char frame[WireHeaderSize + sizeof(WireCommand)];
+        for (size_t s : starts) {
+            parseCommand(block.data() + s, cmd);
+            size_t n = encodeCommand(cmd, frame);
+            frames.insert(frames.end(), frame, frame + n);
+        }
+    }
+    {
+        ClientCommand cmd {};
+        ParseError err = ParseError::None;
+        uint64_t checksum = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        for (size_t at = 0; at < frames.size();) {
+            ptrdiff_t n = decodeCommand(frames.data() + at, frames.size() - at, cmd, err);
+            if (n <= 0)
+                break;
+            at += n;
+            checksum += cmd.order_id + cmd.price;
+        }
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        printf("%-12s %7.1f M cmds/s   %7.1f MB/s  %6.1f ns/cmd   (checksum %llu)\n", "decodeCommand", lines / secs / 1e6,
+               frames.size() / secs / 1e6, secs * 1e9 / lines, (unsigned long long)checksum);
+    }
+
+    // Newline scanning over the raw bytes, what RecvBuffer does before parsing each line
+    std::vector<char> raw(block);
+    for (char& c : raw)
+        if (c == '\0')
+            c = '\n';
+    auto t0 = std::chrono::steady_clock::now();
+    size_t found = 0;
+    for (char* p = raw.data(); (p = findNewline(p, raw.data() + raw.size())); ++p)
+        ++found;
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    printf("%-12s %7.1f GB/s  (%zu lines)\n", "findNewline", raw.size() / secs / 1e9, found);
+    return 0;
+}
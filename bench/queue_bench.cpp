@@ -0,0 +1,116 @@
+// Enqueue-to-dequeue latency of the worker command queue: ThreadSafeQueue vs MpscRing with each WaitStrategy.
+//
+// Every item carries the time it was pushed, the consumer records (pop time - push time).
+// Producers are paced (--gap-ns between pushes) so this measures handoff latency rather than saturation throughput.
+//
+// Usage: queue_bench [--producers=N] [--items=N] [--gap-ns=N]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../src/MpscRing.hpp"
+#include "../src/ThreadSafeQueue.hpp"
+
+namespace {
+
+struct Item {
+    int64_t pushed_ns;
+    uint32_t producer;
+};
+
+int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void pace(int64_t gapNs) {
+    int64_t until = nowNs() + gapNs;
+    while (nowNs() < until) { }
+}
+
+struct Options {
+    unsigned producers = 2;
+    size_t items = 200000; // per producer
+    int64_t gapNs = 2000;
+};
+
+void report(const char* name, std::vector<int64_t>& lat, double seconds) {
+    std::sort(lat.begin(), lat.end());
+    auto pct = [&](double p) { return lat[std::min(lat.size() - 1, size_t(p * lat.size()))]; };
+    printf("%-22s %10.0f msg/s  p50 %8lld ns  p99 %8lld ns  p99.9 %8lld ns  max %10lld ns\n",
+           name, lat.size() / seconds,
+           (long long)pct(0.50), (long long)pct(0.99), (long long)pct(0.999), (long long)lat.back());
+}
+
+// Queue must provide push(const Item&) and wait_pop()
+template<typename Queue>
+void run(const char* name, Queue& q, const Options& opt) {
+    const size_t total = opt.items * opt.producers;
+    std::vector<int64_t> lat;
+    lat.reserve(total);
+
+    int64_t start = nowNs();
+    std::thread consumer([&] {
+        for (size_t i = 0; i < total; ++i) {
+            Item item = q.wait_pop();
+            lat.push_back(nowNs() - item.pushed_ns);
+        }
+    });
+    std::vector<std::thread> producers;
+    for (unsigned p = 0; p < opt.producers; ++p) {
+        producers.emplace_back([&, p] {
+            for (size_t i = 0; i < opt.items; ++i) {
+                q.push(Item{nowNs(), p});
+                pace(opt.gapNs);
+            }
+        });
+    }
+    for (auto& t : producers)
+        t.join();
+    consumer.join();
+    report(name, lat, (nowNs() - start) / 1e9);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options opt;
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--producers=", 12) == 0)
+            opt.producers = std::max(1, atoi(argv[i] + 12));
+        else if (strncmp(argv[i], "--items=", 8) == 0)
+            opt.items = strtoull(argv[i] + 8, nullptr, 10);
+        else if (strncmp(argv[i], "--gap-ns=", 9) == 0)
+            opt.gapNs = strtoll(argv[i] + 9, nullptr, 10);
+        else {
+            fprintf(stderr, "Usage: %s [--producers=N] [--items=N] [--gap-ns=N]\n", argv[0]);
+            return 1;
+        }
+    }
+    printf("queue_bench: %u producers x %zu items, %lld ns between pushes, %u hardware threads\n",
+           opt.producers, opt.items, (long long)opt.gapNs, std::thread::hardware_concurrency());
+
+    {
+        ThreadSafeQueue<Item> q;
+        run("ThreadSafeQueue", q, opt);
+    }
+    {
+        MpscRing<Item> q(4096, WaitStrategy::SpinFutex);
+        run("MpscRing spin+futex", q, opt);
+    }
+    {
+        MpscRing<Item> q(4096, WaitStrategy::SpinYield);
+        run("MpscRing spin+yield", q, opt);
+    }
+    // Busy spinning with fewer cores than threads just measures the scheduler
+    if (std::thread::hardware_concurrency() > opt.producers) {
+        MpscRing<Item> q(4096, WaitStrategy::BusySpin);
+        run("MpscRing busy-spin", q, opt);
+    }
+    return 0;
+}
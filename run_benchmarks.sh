@@ -0,0 +1,34 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+# Builds and runs every bench/*.cpp, output is also saved to bench_output.txt
+# Usage: ./run_benchmarks.sh [bench name ...] (e.g. ./run_benchmarks.sh queue_bench)
+
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+cd "$SCRIPT_DIR"
+
+# Benchmarks link against the engine sources, minus the ones that carry their own main()
+LIB_SRCS=()
+for f in src/*.cpp; do
+  case "$(basename "$f")" in
+    main.cpp|client.cpp|replay.cpp) ;;
+    *) LIB_SRCS+=("$f") ;;
+  esac
+done
+
+mkdir -p bench/bin
+if [[ $# -gt 0 ]]; then
+  benches=("$@")
+else
+  benches=()
+  for f in bench/*.cpp; do benches+=("$(basename "$f" .cpp)"); done
+fi
+
+: > bench_output.txt
+for b in "${benches[@]}"; do
+  echo "Compiling ${b}..."
+  g++ -std=c++17 -O2 -Wall -Wextra -pthread "bench/${b}.cpp" "${LIB_SRCS[@]}" -o "bench/bin/${b}"
+  echo "Running ${b}..."
+  "./bench/bin/${b}" | tee -a bench_output.txt
+  echo | tee -a bench_output.txt
+done
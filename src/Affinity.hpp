@@ -0,0 +1,63 @@
+#pragma once
+#include <cstdlib>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+// CPU pinning helpers for the engine's threads (see EngineConfig's *Cpus options)
+
+// "5", "0-3" or "0-3,8,10-11", false on anything else
+inline bool parseCpuList(const char* spec, std::vector<int>& out) {
+    std::vector<int> cpus;
+    const char* p = spec;
+    while (true) {
+        char* end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0 || first >= CPU_SETSIZE)
+            return false;
+        long last = first;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first || last >= CPU_SETSIZE)
+                return false;
+        }
+        for (long c = first; c <= last; ++c)
+            cpus.push_back(static_cast<int>(c));
+        if (*end == '\0')
+            break;
+        if (*end != ',')
+            return false;
+        p = end + 1;
+    }
+    out = std::move(cpus);
+    return true;
+}
+
+// CPUs this process is allowed to run on, in order
+inline std::vector<int> allowedCpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) != 0)
+        return cpus;
+    for (int i = 0; i < CPU_SETSIZE; ++i)
+        if (CPU_ISSET(i, &set))
+            cpus.push_back(i);
+    return cpus;
+}
+
+// Restricts the calling thread to cpus (all of them when empty is passed, nothing changes), false if the kernel refused
+inline bool pinThisThread(const std::vector<int>& cpus) {
+    if (cpus.empty())
+        return true;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int c : cpus)
+        CPU_SET(c, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+inline bool pinThisThread(int cpu) {
+    return cpu < 0 || pinThisThread(std::vector<int>{cpu});
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <type_traits>
+
+#include "OrderPool.hpp"
+#include "PriceLadder.hpp"
+
+// One side of an instrument's book, best price first.
+// Starts out as a dense PriceLadder when the instrument has a configured tick range and permanently
+// falls back to the red-black tree the first time an order arrives outside of that range.
+// Instruments without a ladder config just use the tree.
+template<bool IsBuy>
+class BookSide {
+public:
+    using Compare = std::conditional_t<IsBuy, std::greater<uint32_t>, std::less<uint32_t>>;
+
+    explicit BookSide(const std::optional<LadderConfig>& ladderCfg = std::nullopt) {
+        if (ladderCfg && PriceLadder::valid(*ladderCfg))
+            ladder = std::make_unique<PriceLadder>(*ladderCfg, IsBuy);
+    }
+
+    bool usesLadder() const { return ladder != nullptr; }
+
+    bool empty() const { return ladder ? ladder->empty() : tree.empty(); }
+
+    // Only valid when !empty()
+    uint32_t bestPrice() const { return ladder ? ladder->bestPrice() : tree.begin()->first; }
+    PriceLevel& bestLevel() { return ladder ? ladder->bestLevel() : tree.begin()->second; }
+
+    // Drops the best level once its last order is gone
+    void popBest() {
+        if (ladder)
+            ladder->markEmpty(ladder->bestPrice());
+        else
+            tree.erase(tree.begin());
+    }
+
+    // Level an order at price is about to be appended to, created if missing
+    PriceLevel& level(uint32_t price) {
+        if (ladder && !ladder->contains(price))
+            fallBackToTree();
+        if (ladder) {
+            ladder->markActive(price);
+            return ladder->at(price);
+        }
+        return tree[price];
+    }
+
+    // Existing level at price, or nullptr
+    PriceLevel* find(uint32_t price) {
+        if (ladder) {
+            if (!ladder->contains(price))
+                return nullptr;
+            PriceLevel& lvl = ladder->at(price);
+            return lvl.empty() ? nullptr : &lvl;
+        }
+        auto it = tree.find(price);
+        return it == tree.end() ? nullptr : &it->second;
+    }
+
+    // The best n levels, best first: f(price, level)
+    template<typename F>
+    void forBest(size_t n, F&& f) {
+        if (n == 0)
+            return;
+        if (ladder) {
+            ladder->forEachWhile([&](uint32_t price, PriceLevel& lvl) { f(price, lvl); return --n > 0; });
+            return;
+        }
+        for (auto it = tree.begin(); it != tree.end() && n > 0; ++it, --n)
+            f(it->first, it->second);
+    }
+
+    // Drops the (now empty) level at price
+    void erase(uint32_t price) {
+        if (ladder)
+            ladder->markEmpty(price);
+        else
+            tree.erase(price);
+    }
+
+private:
+    void fallBackToTree() {
+        // One-off migration, the levels only hold handles so copying them keeps the orders in place
+        ladder->forEach([this](uint32_t price, PriceLevel& lvl) { tree.emplace_hint(tree.end(), price, lvl); });
+        ladder.reset();
+    }
+
+    std::unique_ptr<PriceLadder> ladder;
+    std::map<uint32_t, PriceLevel, Compare> tree;
+};
@@ -0,0 +1,161 @@
+#include "Clock.hpp"
+
+#include <algorithm>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+Clock::Anchor Clock::anchor;
+
+namespace {
+
+// Nanoseconds the clock may have drifted from CLOCK_MONOTONIC and still be slewed back. Beyond that (the TSC stopped
+// across a suspend, a VM was migrated) the anchor is simply reset to CLOCK_MONOTONIC
+constexpr int64_t MaxSlewNs = 1000000;
+constexpr int64_t AnchorIntervalNs = 1000000000;
+constexpr int64_t CalibrationNs = 5000000;
+
+#if defined(__x86_64__)
+
+bool invariantTsc() {
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007)
+        return false;
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return (edx & (1u << 8)) != 0;
+}
+
+struct Sample {
+    uint64_t tsc;
+    int64_t ns;
+};
+
+// A TSC reading and the CLOCK_MONOTONIC time it corresponds to: the tightest of a few tries bracketing
+// clock_gettime between two rdtscs, so an interrupt in the middle doesn't skew it
+Sample sample() {
+    Sample best{0, 0};
+    uint64_t bestSpan = ~uint64_t(0);
+    for (int i = 0; i < 5; ++i) {
+        uint64_t before = __rdtsc();
+        int64_t ns = Clock::monotonic();
+        uint64_t after = __rdtsc();
+        if (after - before < bestSpan) {
+            bestSpan = after - before;
+            best = {before + (after - before) / 2, ns};
+        }
+    }
+    return best;
+}
+
+// ns per tick between two samples, 32.32 fixed point
+uint64_t rate(const Sample& from, const Sample& to) {
+    if (to.tsc <= from.tsc || to.ns <= from.ns)
+        return 0;
+    return static_cast<uint64_t>((static_cast<unsigned __int128>(to.ns - from.ns) << 32) / (to.tsc - from.tsc));
+}
+
+uint64_t ticksFor(int64_t ns, uint64_t mult) {
+    return static_cast<uint64_t>((static_cast<unsigned __int128>(ns) << 32) / mult);
+}
+
+// The last sample the anchor was measured against, only touched by whoever is moving the anchor
+Sample lastSample;
+
+#endif
+
+} // namespace
+
+// Calibrates at startup, before main() and so before any thread stamps anything
+struct ClockCalibration {
+    ClockCalibration() {
+#if defined(__x86_64__)
+        if (!invariantTsc())
+            return;
+        Sample from = sample();
+        while (Clock::monotonic() - from.ns < CalibrationNs)
+            cpuRelax();
+        Sample to = sample();
+        uint64_t mult = rate(from, to);
+        if (mult == 0)
+            return;
+        lastSample = to;
+        Clock::anchor.tsc.store(to.tsc, std::memory_order_relaxed);
+        Clock::anchor.ns.store(to.ns, std::memory_order_relaxed);
+        Clock::anchor.interval.store(ticksFor(AnchorIntervalNs, mult), std::memory_order_relaxed);
+        Clock::anchor.mult.store(mult, std::memory_order_release);
+#endif
+    }
+};
+
+namespace {
+ClockCalibration calibration;
+} // namespace
+
+bool Clock::reanchor(uint32_t before) {
+#if defined(__x86_64__)
+    if (anchor.moving.exchange(true, std::memory_order_acquire))
+        return false;
+    if (anchor.seq.load(std::memory_order_relaxed) != before) {
+        anchor.moving.store(false, std::memory_order_release);
+        return true;
+    }
+
+    // Readers keep using the old anchor meanwhile, only the mover writes it so plain loads will do
+    Sample now = sample();
+    uint64_t mult = anchor.mult.load(std::memory_order_relaxed);
+    uint64_t interval = anchor.interval.load(std::memory_order_relaxed);
+    int64_t anchorNs = anchor.ns.load(std::memory_order_relaxed);
+    // The new anchor starts right before it's stored, so no reader took a stamp off the old one past it
+    uint64_t at = __rdtsc();
+    int64_t elapsed = static_cast<int64_t>(at - anchor.tsc.load(std::memory_order_relaxed));
+    uint64_t ticks = elapsed >= 0 ? static_cast<uint64_t>(elapsed) : 0;
+    int64_t predicted = anchorNs + static_cast<int64_t>(toNanoseconds(ticks, mult));
+    // Readers don't use the old anchor past its interval, so no stamp later than this has been handed out
+    int64_t handedOut = anchorNs + static_cast<int64_t>(toNanoseconds(std::min(ticks, interval), mult));
+    uint64_t measured = rate(lastSample, now);
+    // CLOCK_MONOTONIC at the new anchor
+    int64_t actual = now.ns + static_cast<int64_t>(toNanoseconds(at - now.tsc, measured != 0 ? measured : mult));
+    int64_t error = actual - predicted;
+
+    int64_t ns = predicted;
+    if (measured == 0 || error > MaxSlewNs || error < -MaxSlewNs) {
+        // Too far off to slew: step to CLOCK_MONOTONIC, but never back below a stamp already handed out, or later
+        // events would be stamped before earlier ones. Whatever that leaves the clock ahead by is slewed off below
+        ns = std::max(actual, handedOut);
+        error = actual - ns;
+    }
+    if (measured != 0) {
+        // Keep the time continuous at the new anchor and run a little fast or slow so that by the next one the
+        // error is gone. At most MaxSlewNs over AnchorIntervalNs, a 0.1% change of rate, unless a step was held back
+        // above; then down to half speed until it has caught up
+        int64_t slew = std::max(error, -AnchorIntervalNs / 2);
+        int64_t correction = static_cast<int64_t>((static_cast<__int128>(slew) << 32) / static_cast<__int128>(interval));
+        mult = static_cast<uint64_t>(static_cast<int64_t>(measured) + correction);
+    }
+    lastSample = now;
+
+    anchor.next.store(ns, std::memory_order_relaxed);
+    anchor.seq.store(before + 1, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_release);
+    anchor.tsc.store(at, std::memory_order_relaxed);
+    anchor.ns.store(ns, std::memory_order_relaxed);
+    anchor.mult.store(mult, std::memory_order_relaxed);
+    anchor.interval.store(ticksFor(AnchorIntervalNs, mult), std::memory_order_relaxed);
+    anchor.seq.store(before + 2, std::memory_order_release);
+    anchor.moving.store(false, std::memory_order_release);
+    return true;
+#else
+    (void)before;
+    return false;
+#endif
+}
+
+const char* Clock::source() {
+    return anchor.mult.load(std::memory_order_acquire) != 0 ? "tsc" : "clock_gettime";
+}
+
+double Clock::tscGhz() {
+    uint64_t mult = anchor.mult.load(std::memory_order_acquire);
+    return mult != 0 ? 4294967296.0 / static_cast<double>(mult) : 0;
+}
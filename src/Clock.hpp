@@ -0,0 +1,109 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+
+#include "CpuRelax.hpp"
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+// The engine's timestamps: nanoseconds on the CLOCK_MONOTONIC timeline (the same one std::chrono::steady_clock uses on
+// Linux, so stamps compare with other processes on the host), read from the TSC whenever it can be trusted.
+//
+// With an invariant TSC (ticking at a constant rate whatever the core's P-state or C-state, cpuid 0x80000007 EDX bit
+// 8) a stamp is an rdtsc and a multiply, a few ns, against roughly 20 for a clock_gettime through the vDSO. Ticks are
+// converted relative to an anchor: a TSC value, the nanoseconds it stands for and a rate, calibrated at startup.
+// The first stamp taken more than a second after the anchor moves it: the rate is measured again over that second
+// and nudged so whatever the clock drifted from CLOCK_MONOTONIC (calibration error, NTP slewing) is made up over the
+// next second instead of stepping the time. The anchor is shared by all threads behind a sequence counter (seqlock),
+// readers only ever wait for the few stores that put a new one in place. Stamps never go backwards across an anchor
+// move, not even when the clock has to be stepped.
+//
+// Without an invariant TSC (other CPUs, or a hypervisor not advertising it) every stamp is a clock_gettime.
+class Clock {
+public:
+    static int64_t nanoseconds() {
+#if defined(__x86_64__)
+        for (unsigned spins = 0;;) {
+            uint32_t before = anchor.seq.load(std::memory_order_acquire);
+            if (before & 1) {
+                // The new anchor is being stored, a handful of stores. Only when whoever stores it was preempted right
+                // then does this stop waiting and take the time the new anchor starts at: no stamp handed out before
+                // it is later, none after it is earlier
+                if (++spins < MaxSpins) {
+                    cpuRelax();
+                    continue;
+                }
+                return anchor.next.load(std::memory_order_acquire);
+            }
+            uint64_t tsc = __rdtsc();
+            uint64_t anchorTsc = anchor.tsc.load(std::memory_order_relaxed);
+            int64_t anchorNs = anchor.ns.load(std::memory_order_relaxed);
+            uint64_t mult = anchor.mult.load(std::memory_order_relaxed);
+            uint64_t interval = anchor.interval.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (anchor.seq.load(std::memory_order_relaxed) != before)
+                continue;
+            // Not calibrated (no invariant TSC, or a stamp from a static initializer before calibration)
+            if (mult == 0)
+                break;
+            // Another core may read its TSC a little before the anchor it then sees: the anchor's time, never less
+            int64_t elapsed = static_cast<int64_t>(tsc - anchorTsc);
+            if (elapsed < 0)
+                return anchorNs;
+            if (static_cast<uint64_t>(elapsed) <= interval)
+                return anchorNs + static_cast<int64_t>(toNanoseconds(static_cast<uint64_t>(elapsed), mult));
+            // Due for a new anchor. While another thread is moving it, the time stays at the end of this one
+            if (!reanchor(before))
+                return anchorNs + static_cast<int64_t>(toNanoseconds(interval, mult));
+        }
+#endif
+        return monotonic();
+    }
+
+    // What nanoseconds() is read from, "tsc" or "clock_gettime"
+    static const char* source();
+    // Current TSC rate in ticks per ns (GHz), 0 without the TSC
+    static double tscGhz();
+
+    static int64_t monotonic() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+private:
+    friend struct ClockCalibration;
+
+    struct Anchor {
+        std::atomic<uint32_t> seq{0};
+        std::atomic<uint64_t> tsc{0};
+        std::atomic<int64_t> ns{0};
+        // ns per tick, 32.32 fixed point. 0 until calibrated
+        std::atomic<uint64_t> mult{0};
+        // Ticks after which the anchor is moved
+        std::atomic<uint64_t> interval{0};
+        // Set by the one thread moving the anchor, for as long as it's at it
+        std::atomic<bool> moving{false};
+        // The ns of the anchor being stored, for readers that won't wait for it
+        std::atomic<int64_t> next{0};
+    };
+
+    static constexpr unsigned MaxSpins = 256;
+
+    static uint64_t toNanoseconds(uint64_t ticks, uint64_t mult) {
+        return static_cast<uint64_t>((static_cast<unsigned __int128>(ticks) * mult) >> 32);
+    }
+
+    // Moves the anchor unless another thread is moving it (false), or already has since sequence before
+    static bool reanchor(uint32_t before);
+
+    static Anchor anchor;
+};
+
+// Nanoseconds, see Clock
+inline int64_t getCurrentTimestamp() {
+    return Clock::nanoseconds();
+}
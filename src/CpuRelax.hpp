@@ -0,0 +1,11 @@
+#pragma once
+
+// Spin-wait hint: tells the core we're busy waiting so it can back off the pipeline / yield to the sibling hyperthread
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
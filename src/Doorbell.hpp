@@ -0,0 +1,33 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Lets one consumer thread sleep on a futex when it runs out of work, without producers paying for a syscall
+// (or a lock) unless the consumer really is asleep.
+class Doorbell {
+public:
+    // Consumer side. hasWork is re-checked after announcing the sleep, a producer that published before seeing
+    // the flag is caught by that re-check and one that published after it sees the flag and rings
+    template<typename F>
+    void sleepUnless(F&& hasWork) {
+        sleeping.store(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!hasWork())
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&sleeping), FUTEX_WAIT_PRIVATE, 1, nullptr, nullptr, 0);
+        sleeping.store(0, std::memory_order_relaxed);
+    }
+
+    // Producer side, after publishing. The common case is a fence plus one load that sees 0
+    void ring() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping.load(std::memory_order_relaxed) && sleeping.exchange(0, std::memory_order_relaxed))
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&sleeping), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+    }
+
+private:
+    std::atomic<uint32_t> sleeping{0};
+};
@@ -1,196 +1,147 @@
 #include "InstrumentWorker.hpp"
-#include "engine.hpp"  
-#include <iostream>
-
-InstrumentWorker::InstrumentWorker(const std::string& instr)
-    : instrument(instr) { }
-
-
-void InstrumentWorker::start() {
-    // Start a single worker thread per instrument
-    workerThread = std::thread([this]() {
-        try {
-            while (!stop) {
-                
-                // Block until a command is available in the queue
-                ClientCommand cmd = commandQueue.wait_pop();
-                
-                // Process the command based on its type
-                switch (cmd.type) {
-                    case input_buy:
-                        this->processBuyOrder(cmd);
-                        break;
-                    case input_sell:
-                        this->processSellOrder(cmd);
-                        break;
-                    case input_cancel:
-                        this->processCancelOrder(cmd);
-                        break;
-                    default:
-                        // Unknown command types are ignored
-                        break;
-                }
-            }
-        } catch (const std::exception& ex) {
-            SyncCerr() << "Exception in worker for instrument " << instrument 
-                       << ": " << ex.what() << std::endl;
-        } catch (...) {
-            SyncCerr() << "Unknown exception in worker for instrument " << instrument << std::endl;
-        }
-    });
+#include <algorithm>
+#include <cstring>
+#include "engine.hpp"
+
+InstrumentWorker::InstrumentWorker(const std::string& instr, uint32_t symbolId, OrderRouter& router, MatchingShard& shard,
+                                   const std::optional<LadderConfig>& ladder, std::unique_ptr<LatencyStats> latency,
+                                   InstrumentJournal* journal)
+    : instrument(instr), id(symbolId), shard(shard), latency(std::move(latency)), journal(journal), marketData(shard.marketData()),
+      events{shard.output(), router, this}, ladder(ladder) {
+    memcpy(packedSymbol, instrument.data(), std::min(instrument.size(), sizeof(packedSymbol)));
 }
 
-
-void InstrumentWorker::processBuyOrder(const ClientCommand& cmd) {
-    auto orderPtr = std::make_shared<Order>();
-    orderPtr->order_id   = cmd.order_id;
-    orderPtr->price      = cmd.price;
-    orderPtr->quantity   = cmd.count;
-    orderPtr->instrument = cmd.instrument;
-    orderPtr->side       = Side::BUY;
-
-    // Reason why i made pq take in ptrs is bc intially above I was doing raw value then in the below,
-    // I was adding a reference, once the Order gets popped off the stack, Im left w a dangling reference
-
-    // Made OrderPtr a shared pointer because I want it to be copied onto the pq -> so it exists in pq and one in the map
-    // map one goes out of scope when cancelled, heap goes ouf of scope when popped
-    // so automatic destructor and dealloacation of memory
-
-    while (!sellMap.empty() && orderPtr->quantity > 0 && sellMap.begin()->first <= orderPtr->price) {
-        auto lowestPriceLevelIterator = sellMap.begin();
-        auto& list = lowestPriceLevelIterator->second;
-        while (orderPtr->quantity && !list.empty()) {
-            auto top = list.front();
-            uint32_t m = std::min(orderPtr->quantity, top->quantity);
-            orderPtr->quantity -= m;
-            top->quantity      -= m;
-            auto ts = getCurrentTimestamp();
-            Output::OrderExecuted(top->order_id, orderPtr->order_id,
-                                    orderPtr->order_id, top->price, m, ts);
-            if (top->quantity == 0) {
-                orderMap.erase(top->order_id);
-                list.pop_front();
-            }
+void InstrumentWorker::process(const ClientCommand& cmd, int64_t dequeued) {
+    if (!book)
+        book.emplace(instrument, events, ladder);
+    // Written ahead: the journal has the command before the book acts on it
+    if (journal) {
+        // A command that can't be journaled isn't acted on at all, and a refused order was never routed here. Nor is one
+        // whose events could never be published
+        if (journal->failed() || shard.journal()->failed()) {
+            refuse(cmd, dequeued);
+            return;
         }
-        if (list.empty()) {
-            sellMap.erase(lowestPriceLevelIterator);
-        }
-    }
-    if (orderPtr->quantity > 0) {
-        auto& priceList = buyMap[orderPtr->price];
-        priceList.push_back(orderPtr);
-        auto it = std::prev(priceList.end());
-
-        orderMap[orderPtr->order_id] = OrderDetails {
-            orderPtr, it
-        };
-        auto ts = getCurrentTimestamp();
-        Output::OrderAdded(orderPtr->order_id, orderPtr->instrument.c_str(),
-                            orderPtr->price, orderPtr->quantity, false, ts);
+        shard.journal()->append(journal, cmd);
+        ++journalSeq;
     }
+    // All of the command's events carry the time it was dequeued
+    book->apply(cmd, dequeued);
+    uint64_t every = journal ? shard.journal()->snapshotEvery() : 0;
+    if (every && journalSeq - snapshotSeq >= every)
+        snapshotBook();
+    // Snapshots let a consumer that joined late (or lost updates) get in sync, a book's first one goes out right away
+    if (marketData && (levelUpdates >= SnapshotEvery || lastSnapshot == 0 || dequeued - lastSnapshot >= SnapshotIntervalNs))
+        publishSnapshot(dequeued);
+    if (cmd.read_ts && latency)
+        latency->recordCommand(cmd.read_ts, cmd.enqueue_ts, dequeued, getCurrentTimestamp());
+    done(cmd);
 }
 
+void InstrumentWorker::refuse(const ClientCommand& cmd, int64_t dequeued) {
+    if (cmd.type == input_buy || cmd.type == input_sell)
+        events.OrderRemoved(cmd.order_id);
+    // The shard's ring is held for good once its journal ring failed, the refusal has to go around it
+    if (shard.journal()->failed())
+        shard.sharedOutput().OrderRefused(cmd.order_id, static_cast<char>(cmd.type), dequeued);
+    else
+        events.output.OrderRefused(cmd.order_id, static_cast<char>(cmd.type), dequeued);
+    done(cmd);
+}
 
-
-void InstrumentWorker::processSellOrder(const ClientCommand& cmd) {
-    auto orderPtr = std::make_shared<Order>();
-    orderPtr->order_id   = cmd.order_id;
-    orderPtr->price      = cmd.price;
-    orderPtr->quantity   = cmd.count;
-    orderPtr->instrument = cmd.instrument;
-    orderPtr->side       = Side::SELL;
-
-    // Cross against best bids
-    while (!buyMap.empty() && orderPtr->quantity > 0 && buyMap.begin()->first >= orderPtr->price) {
-        auto highestPriceLevelIterator = buyMap.begin();
-        auto& list = highestPriceLevelIterator->second;   // std::list<OrderPtr>&
-
-        while (orderPtr->quantity && !list.empty()) {
-            auto top = list.front();
-            uint32_t m = std::min(orderPtr->quantity, top->quantity);
-            orderPtr->quantity -= m;
-            top->quantity      -= m;
-
-            auto ts = getCurrentTimestamp();
-            Output::OrderExecuted(top->order_id, orderPtr->order_id,
-                                  orderPtr->order_id, top->price, m, ts);
-
-            if (top->quantity == 0) {
-                orderMap.erase(top->order_id);
-                list.pop_front();
+void InstrumentWorker::recover(const JournalWriter::Recovered& journaled) {
+    if (!book)
+        book.emplace(instrument, events, ladder);
+    events.replaying = true;
+    size_t from = 0;
+    if (const SnapshotHeader* snap = journaled.snapshot) {
+        // Levels don't cross, so adding the orders back level by level just rests them in their old time priority
+        const SnapshotOrder* o = journaled.orders;
+        for (uint32_t l = 0; l < snap->bidLevels + snap->askLevels; ++l) {
+            const SnapshotLevel& lvl = journaled.levels[l];
+            bool is_sell_side = l >= snap->bidLevels;
+            for (uint32_t i = 0; i < lvl.orders; ++i, ++o) {
+                events.router.insert(o->order_id, this);
+                if (is_sell_side)
+                    book->sell(o->order_id, lvl.price, o->quantity, 0);
+                else
+                    book->buy(o->order_id, lvl.price, o->quantity, 0);
             }
         }
-        if (list.empty()) {
-            buyMap.erase(highestPriceLevelIterator);
-        }
+        from = snap->journalSeq;
+        snapshotSeq = snap->journalSeq;
     }
-
-    // Rest remainder on the ask side
-    if (orderPtr->quantity > 0) {
-        auto& priceList = sellMap[orderPtr->price]; // creates the level if missing
-        priceList.push_back(orderPtr);
-        auto it = std::prev(priceList.end());
-
-        orderMap[orderPtr->order_id] = OrderDetails{
-            orderPtr, it
-        };
-
-        auto ts = getCurrentTimestamp();
-        Output::OrderAdded(orderPtr->order_id, orderPtr->instrument.c_str(),
-                           orderPtr->price, orderPtr->quantity, /*isSell=*/true, ts);
+    for (size_t i = from; i < journaled.count; ++i) {
+        const JournalRecord& r = journaled.records[i];
+        switch (r.type) {
+            case input_buy:
+                events.router.insert(r.order_id, this);
+                book->buy(r.order_id, r.price, r.count, 0);
+                break;
+            case input_sell:
+                events.router.insert(r.order_id, this);
+                book->sell(r.order_id, r.price, r.count, 0);
+                break;
+            case input_cancel:
+                book->cancel(r.order_id, 0);
+                break;
+            case input_amend:
+                book->amend(r.order_id, r.price, r.count, 0);
+                break;
+            default:
+                break;
+        }
     }
+    journalSeq = journaled.count;
+    events.replaying = false;
 }
 
-
-void InstrumentWorker::processCancelOrder(const ClientCommand& cmd) {
-    const uint32_t id = cmd.order_id;
-    bool ok = false;
-    auto iterator = orderMap.find(id);
-    if (iterator != orderMap.end()) {
-            auto& orderPtr = iterator->second.ptr;
-
-            if (orderPtr->side == Side::BUY) {
-            
-                auto lvl = buyMap.find(orderPtr->price);
-                if (lvl != buyMap.end())
-                {
-                    lvl->second.erase(iterator->second.it);      // O(1) erase by iterator
-                    if (lvl->second.empty())
-                        buyMap.erase(lvl);          // drop empty price level
-                    ok = true;
-                }
-            }
-            else {
-                auto lvl = sellMap.find(orderPtr->price);
-                if (lvl != sellMap.end())
-                {
-                    lvl->second.erase(iterator->second.it);      
-                    if (lvl->second.empty())
-                        sellMap.erase(lvl);        
-                    ok = true;
-                }                
-            }
-
-            // Always remove from the index to avoid dangling iterators / double-cancels
-            orderMap.erase(iterator);
-        }
-    
-    
-    Output::OrderDeleted(id, ok, getCurrentTimestamp());
+void InstrumentWorker::snapshotBook() {
+    auto snap = std::make_unique<BookSnapshot>();
+    snap->journal = journal;
+    SnapshotHeader& h = snap->header;
+    h = SnapshotHeader{};
+    memcpy(h.magic, SnapshotHeader::Magic, sizeof(h.magic));
+    memcpy(h.symbol, packedSymbol, sizeof(h.symbol));
+    h.symbolId = id;
+    h.journalSeq = journalSeq;
+    snap->orders.reserve(book->liveOrders());
+    book->forEachResting(
+        [&](bool is_sell_side, uint32_t price, uint64_t quantity, uint32_t orders) {
+            snap->levels.push_back(SnapshotLevel{price, orders, quantity});
+            ++(is_sell_side ? h.askLevels : h.bidLevels);
+        },
+        [&](uint32_t order_id, uint32_t quantity) { snap->orders.push_back(SnapshotOrder{order_id, quantity}); });
+    h.orders = snap->orders.size();
+    shard.journal()->snapshot(std::move(snap));
+    snapshotSeq = journalSeq;
 }
 
-
-void InstrumentWorker::stopAndJoin() {
-    stop = true;
-    // Push dummy command to unblock if thread is waiting
-    commandQueue.push(ClientCommand());
-    if (workerThread.joinable())
-        // join bc threads use up space -> they have their own portion of stack memory, register values, kernel stack space (used during syscalls and interrupts)
-        // in Linux , each process and thread both are represented by a task_struct, threads just share certain resources such as the virtual address space
-        // In in a classic OS textbook, thread's info lives in the PCB (or a TCB linked to it).
-        workerThread.join();
+void InstrumentWorker::publishLevel(char type, bool is_sell_side, uint32_t price, uint64_t quantity, uint32_t orders, int64_t ts) {
+    MarketDataEvent e{};
+    e.type = type;
+    e.side = is_sell_side ? 'S' : 'B';
+    e.symbolId = id;
+    e.price = price;
+    e.orders = orders;
+    e.quantity = quantity;
+    memcpy(e.symbol, packedSymbol, sizeof(e.symbol));
+    e.timestamp = ts;
+    marketData->publish(e);
 }
 
-void InstrumentWorker::addOrder(const ClientCommand& cmd) {
-    commandQueue.push(cmd);
-}
\ No newline at end of file
+void InstrumentWorker::publishSnapshot(int64_t ts) {
+    MarketDataEvent frame{};
+    frame.symbolId = id;
+    memcpy(frame.symbol, packedSymbol, sizeof(frame.symbol));
+    frame.timestamp = ts;
+    frame.type = 'S';
+    marketData->publish(frame);
+    book->depth(shard.marketDataDepth(), [&](bool is_sell_side, uint32_t price, uint64_t quantity, uint32_t orders) {
+        publishLevel('L', is_sell_side, price, quantity, orders, ts);
+    });
+    frame.type = 'E';
+    marketData->publish(frame);
+    levelUpdates = 0;
+    lastSnapshot = ts;
+}
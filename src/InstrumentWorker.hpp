@@ -1,54 +1,170 @@
 #pragma once
-#include <string>
-#include <thread>
 #include <atomic>
-#include <list>
-#include <map>
+#include <string>
+#include <memory>
+#include <optional>
 #include "io.hpp"
-#include "ThreadSafeQueue.hpp"  // Or whatever your thread-safe queue is called
+#include "Journal.hpp"
+#include "OrderBook.hpp"
+#include "OrderRouter.hpp"
+#include "OutputPublisher.hpp"
+#include "LatencyStats.hpp"
+#include "MatchingShard.hpp"
 
 class Engine;
 
+// One instrument's book and where its events go. It has no thread of its own: commands are queued on the
+// MatchingShard the instrument was assigned to and the shard thread calls process() for them, one at a time.
 class InstrumentWorker {
 public:
-    InstrumentWorker(const std::string& instr);
-    ~InstrumentWorker() { stopAndJoin(); }
-    
-    void start();
-    void stopAndJoin();
-    void addOrder(const ClientCommand& cmd);
+    InstrumentWorker(const std::string& instr,
+                     uint32_t symbolId,
+                     OrderRouter& router,
+                     MatchingShard& shard,
+                     const std::optional<LadderConfig>& ladder = std::nullopt,
+                     std::unique_ptr<LatencyStats> latency = nullptr,
+                     InstrumentJournal* journal = nullptr);
+
+    // Any thread: queue a command for this instrument on its shard, cancels on its cancel lane if it has one
+    void addOrder(const ClientCommand& cmd) {
+        if (cmd.type == input_cancel) {
+            shard.pushCancel(this, cmd);
+            return;
+        }
+        // Counted before it's queued, so a cancel queued after it on the lane sees it
+        if (cmd.type == input_amend)
+            amends.fetch_add(1, std::memory_order_relaxed);
+        shard.push(this, cmd);
+    }
+
+    // Admission, any thread. Commands for this instrument queued and not processed yet: tryAdmit takes a place for one
+    // more unless limit (0: no limit) are queued already, the shard thread gives it back once it's processed
+    bool tryAdmit(uint32_t limit) {
+        uint32_t depth = queued.fetch_add(1, std::memory_order_relaxed) + 1;
+        if (limit && depth > limit) {
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+        noteDepth(depth);
+        return true;
+    }
+    // A place whatever the limit (cancels, when shedding)
+    void forceAdmit() { noteDepth(queued.fetch_add(1, std::memory_order_relaxed) + 1); }
+    // Commands that found the queue full, returns the count before this one
+    uint64_t countOverload() { return overloads.fetch_add(1, std::memory_order_relaxed); }
+
+    uint32_t queuedCommands() const { return queued.load(std::memory_order_relaxed); }
+    // Most commands ever queued at once
+    uint32_t queueHighWater() const { return highWater.load(std::memory_order_relaxed); }
+    uint64_t overloadCount() const { return overloads.load(std::memory_order_relaxed); }
+
+    // Shard thread only, dequeued is when the shard popped cmd
+    void process(const ClientCommand& cmd, int64_t dequeued);
+    // Shard thread only: whether a cancel of order id may be applied ahead of the commands queued before it. Only if
+    // the order is in the book and no amend (which may be for that order) is queued: it mustn't overtake either
+    bool cancelMayJump(uint32_t id) const {
+        return amends.load(std::memory_order_relaxed) == 0 && book && book->resting(id);
+    }
+
+    // Shard thread, before it takes any command: rebuilds the book from its latest snapshot and the journal after it.
+    // Nothing is published (it was the first time round), but the router learns about every order that is still resting
+    void recover(const JournalWriter::Recovered& journaled);
+
+    // nullptr unless the engine tracks latency
+    const LatencyStats* latencyStats() const { return latency.get(); }
 
-    ThreadSafeQueue<ClientCommand> commandQueue;
+    MatchingShard& matchingShard() const { return shard; }
+    const std::string& symbol() const { return instrument; }
+    // Dense, engine wide: 0 for the first instrument seen, 1 for the next and so on
+    uint32_t symbolId() const { return id; }
 
 private:
-    enum class Side { BUY, SELL };
-    struct Order {
-        uint32_t    order_id;
-        uint32_t    price;
-        uint32_t    quantity;
-        std::string instrument;
-        Side        side;
+    // Level updates between two L2 snapshots of this book, and the longest a snapshot is held back on a quiet book
+    static constexpr uint32_t SnapshotEvery = 1024;
+    static constexpr int64_t SnapshotIntervalNs = 1000000000;
+
+    // Where the book's events go: the shard's output ring, the market data feed, and the router for orders that are gone
+    struct BookEvents {
+        // The shard's lane to the output publisher, only ever written from the shard thread
+        OutputRing& output;
+        // Engine wide order_id -> worker index, entries for this worker's orders are dropped here once they're gone
+        OrderRouter& router;
+        InstrumentWorker* worker;
+        // Set while replaying the journal: only the router hears about it
+        bool replaying = false;
+
+        void OrderAdded(uint32_t id, const char* symbol, uint32_t price, uint32_t count, bool is_sell_side, int64_t ts) {
+            if (!replaying)
+                output.OrderAdded(id, symbol, price, count, is_sell_side, ts);
+        }
+        void OrderExecuted(uint32_t resting_id, uint32_t new_id, uint32_t execution_id, uint32_t price, uint32_t count, int64_t ts) {
+            if (!replaying)
+                output.OrderExecuted(resting_id, new_id, execution_id, price, count, ts);
+        }
+        void OrderDeleted(uint32_t id, bool cancel_accepted, int64_t ts) {
+            if (!replaying)
+                output.OrderDeleted(id, cancel_accepted, ts);
+        }
+        void OrderAmended(uint32_t id, bool accepted, uint32_t price, uint32_t count, int64_t ts) {
+            if (!replaying)
+                output.OrderAmended(id, accepted, price, count, ts);
+        }
+        void OrderRemoved(uint32_t id) { router.erase(id, worker); }
+        void LevelChanged(bool is_sell_side, uint32_t price, uint64_t quantity, uint32_t orders, int64_t ts) {
+            if (worker->marketData && !replaying) {
+                worker->publishLevel('U', is_sell_side, price, quantity, orders, ts);
+                ++worker->levelUpdates;
+            }
+        }
     };
-    using OrderPtr = std::shared_ptr<Order>;
+
+    void noteDepth(uint32_t depth) {
+        uint32_t high = highWater.load(std::memory_order_relaxed);
+        while (depth > high && !highWater.compare_exchange_weak(high, depth, std::memory_order_relaxed)) { }
+    }
+
+    // A command processed (or refused), its admission place goes back
+    void done(const ClientCommand& cmd) {
+        if (cmd.type == input_amend)
+            amends.fetch_sub(1, std::memory_order_relaxed);
+        queued.fetch_sub(1, std::memory_order_relaxed);
+    }
+    // Turns a command down on the shard thread, with an 'R' event
+    void refuse(const ClientCommand& cmd, int64_t dequeued);
+
+    void publishLevel(char type, bool is_sell_side, uint32_t price, uint64_t quantity, uint32_t orders, int64_t ts);
+    // Top marketDataDepth levels of each side, framed by 'S' and 'E' records
+    void publishSnapshot(int64_t ts);
+    // Copies the book for the journal thread to write out as of journalSeq
+    void snapshotBook();
 
     std::string instrument;
-    std::atomic<bool> stop{false};  
-
-    // Single worker thread per instrument
-    std::thread workerThread;
-    // Map order_id -> live Order* (owned inside the priority queues implicitly)
-    // SHARED POINTER BECAUSE WE WANT IT TO BE OWNED BY BOTH THE BBST AND ALSO ORDER MAP;
-    std::map<uint32_t, std::list<OrderPtr>, std::greater<uint32_t>> buyMap;
-    std::map<uint32_t, std::list<OrderPtr>, std::less<uint32_t>> sellMap;
-
-    struct OrderDetails {
-        OrderPtr ptr;
-        std::list<OrderPtr>::iterator it;
-    };
+    uint32_t id;
+    MatchingShard& shard;
+    // Recorded by the shard thread for commands that come with a read stamp
+    std::unique_ptr<LatencyStats> latency;
+    // This instrument's file in the journal, nullptr when the engine runs without one
+    InstrumentJournal* journal;
+    // Records in the journal so far and as of the latest snapshot (shard thread only)
+    uint64_t journalSeq = 0;
+    uint64_t snapshotSeq = 0;
+
+    // The shard's L2 ring, nullptr when the engine runs without a market data feed
+    MarketDataRing* marketData;
+    char packedSymbol[8] = {};
+    uint32_t levelUpdates = 0;
+    int64_t lastSnapshot = 0;
 
-    std::unordered_map<uint32_t, OrderDetails> orderMap;
-    void processBuyOrder(const ClientCommand& cmd);
-    void processSellOrder(const ClientCommand& cmd);
-    void processCancelOrder(const ClientCommand& cmd);
+    // Admission counters, touched by every producer and the shard thread, so on a line of their own
+    alignas(64) std::atomic<uint32_t> queued{0};
+    std::atomic<uint32_t> highWater{0};
+    std::atomic<uint64_t> overloads{0};
+    // Amends queued and not processed yet, see cancelMayJump
+    std::atomic<uint32_t> amends{0};
 
-};
\ No newline at end of file
+    alignas(64) BookEvents events;
+    std::optional<LadderConfig> ladder;
+    // Only ever touched from the shard thread, which also builds it on the first command: with the kernel's first touch
+    // policy the pool, index and ladder pages then come from the NUMA node of the core the shard runs on
+    std::optional<OrderBook<BookEvents>> book;
+};
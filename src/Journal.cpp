@@ -0,0 +1,382 @@
+#include "Journal.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "OutputPublisher.hpp"
+#include "SymbolTable.hpp"
+
+namespace {
+
+std::runtime_error journalError(const std::string& path, const char* what) {
+    return std::runtime_error("journal " + path + ": " + what + ": " + strerror(errno));
+}
+
+// write until everything is out, picking up after partial writes. Returns how much was written, less than n only on
+// an error (errno set)
+size_t writeSome(int fd, const char* p, size_t n) {
+    size_t done = 0;
+    while (done < n) {
+        ssize_t w = write(fd, p + done, n - done);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        done += static_cast<size_t>(w);
+    }
+    return done;
+}
+
+bool writeAll(int fd, const char* p, size_t n) {
+    return writeSome(fd, p, n) == n;
+}
+
+constexpr const char* Suffix = ".journal";
+constexpr const char* SnapshotSuffix = ".snapshot";
+
+// Maps path read only, nullptr (and bytes 0) when it isn't there or is empty
+void* mapFile(const std::string& path, size_t& bytes) {
+    bytes = 0;
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        return nullptr;
+    struct stat st;
+    void* map = nullptr;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        map = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+            map = nullptr;
+        else
+            bytes = static_cast<size_t>(st.st_size);
+    }
+    close(fd);
+    return map;
+}
+
+// The latest snapshot next to a journal, if it's whole and matches the journal
+void loadSnapshot(const std::string& path, JournalWriter::Recovered& r) {
+    size_t bytes;
+    void* map = mapFile(path, bytes);
+    if (!map)
+        return;
+    const auto* h = static_cast<const SnapshotHeader*>(map);
+    bool ok = bytes >= sizeof(SnapshotHeader) && memcmp(h->magic, SnapshotHeader::Magic, sizeof(h->magic)) == 0
+        && bytes == sizeof(SnapshotHeader) + (uint64_t(h->bidLevels) + h->askLevels) * sizeof(SnapshotLevel)
+                    + h->orders * sizeof(SnapshotOrder)
+        && h->journalSeq <= r.count && strncmp(h->symbol, r.symbol.c_str(), sizeof(h->symbol)) == 0;
+    if (!ok) {
+        fprintf(stderr, "[SERVER] ignoring snapshot %s, replaying the whole journal\n", path.c_str());
+        munmap(map, bytes);
+        return;
+    }
+    r.snapshot = h;
+    r.levels = reinterpret_cast<const SnapshotLevel*>(h + 1);
+    r.orders = reinterpret_cast<const SnapshotOrder*>(r.levels + h->bidLevels + h->askLevels);
+    r.snapshotMap = map;
+    r.snapshotBytes = bytes;
+}
+
+} // namespace
+
+InstrumentJournal::~InstrumentJournal() {
+    close(fd);
+}
+
+void JournalRing::snapshot(std::unique_ptr<BookSnapshot> s) {
+    {
+        std::lock_guard<std::mutex> lock(writer.snapshotsMutex);
+        writer.snapshots.push_back(std::move(s));
+    }
+    bell.ring();
+}
+
+void JournalRing::holdOutput(OutputRing& out) {
+    output = &out;
+    out.holdUntilJournaled(tail, durable);
+}
+
+uint64_t JournalRing::snapshotEvery() const {
+    return writer.snapshotEvery();
+}
+
+bool JournalRing::syncs() const {
+    return writer.syncs();
+}
+
+JournalWriter::JournalWriter(std::string directory, bool sync, uint64_t snapshotEvery)
+    : dir(std::move(directory)), sync(sync), everyCommands(snapshotEvery) {
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+        throw journalError(dir, "mkdir");
+}
+
+std::vector<JournalWriter::Recovered> JournalWriter::recover() {
+    std::vector<Recovered> found;
+    DIR* d = opendir(dir.c_str());
+    if (!d)
+        throw journalError(dir, "opendir");
+    std::vector<std::string> files;
+    while (struct dirent* entry = readdir(d)) {
+        std::string name = entry->d_name;
+        if (name.size() > strlen(Suffix) && name.compare(name.size() - strlen(Suffix), std::string::npos, Suffix) == 0)
+            files.push_back(dir + "/" + name);
+    }
+    closedir(d);
+
+    for (const std::string& path : files) {
+        int fd = ::open(path.c_str(), O_RDWR);
+        if (fd == -1)
+            throw journalError(path, "open");
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw journalError(path, "fstat");
+        }
+        size_t bytes = static_cast<size_t>(st.st_size);
+        if (bytes < sizeof(JournalHeader)) {
+            // Died before the header made it out, there can't be any records either
+            close(fd);
+            unlink(path.c_str());
+            continue;
+        }
+        size_t count = (bytes - sizeof(JournalHeader)) / sizeof(JournalRecord);
+        size_t whole = sizeof(JournalHeader) + count * sizeof(JournalRecord);
+        if (whole != bytes && ftruncate(fd, static_cast<off_t>(whole)) != 0) {
+            close(fd);
+            throw journalError(path, "ftruncate");
+        }
+        void* map = mmap(nullptr, whole, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED)
+            throw journalError(path, "mmap");
+        madvise(map, whole, MADV_SEQUENTIAL);
+
+        const auto* header = static_cast<const JournalHeader*>(map);
+        if (memcmp(header->magic, JournalHeader::Magic, sizeof(header->magic)) != 0) {
+            munmap(map, whole);
+            throw std::runtime_error("journal " + path + ": not a journal");
+        }
+        Recovered r;
+        r.symbol.assign(header->symbol, strnlen(header->symbol, sizeof(header->symbol)));
+        r.symbolId = header->symbolId;
+        r.records = reinterpret_cast<const JournalRecord*>(header + 1);
+        r.count = count;
+        r.map = map;
+        r.mapBytes = whole;
+        // With a snapshot only the journal's tail is ever touched, the mapping costs nothing for the rest
+        loadSnapshot(path.substr(0, path.size() - strlen(Suffix)) + SnapshotSuffix, r);
+        found.push_back(std::move(r));
+    }
+    std::sort(found.begin(), found.end(), [](const Recovered& a, const Recovered& b) { return a.symbolId < b.symbolId; });
+    return found;
+}
+
+void JournalWriter::release(Recovered& r) {
+    if (r.map)
+        munmap(r.map, r.mapBytes);
+    if (r.snapshotMap)
+        munmap(r.snapshotMap, r.snapshotBytes);
+    r = Recovered{};
+}
+
+JournalRing& JournalWriter::createRing() {
+    rings.push_back(std::make_unique<JournalRing>(*this, bell));
+    return *rings.back();
+}
+
+InstrumentJournal* JournalWriter::open(const std::string& symbol, uint32_t symbolId) {
+    char name[32];
+    snprintf(name, sizeof(name), "/%016" PRIx64, SymbolTable<InstrumentJournal>::pack(symbol.c_str()));
+    std::string path = dir + name + Suffix;
+    int fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd == -1)
+        throw journalError(path, "open");
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw journalError(path, "fstat");
+    }
+    uint64_t records = 0;
+    if (st.st_size == 0) {
+        JournalHeader header{};
+        memcpy(header.magic, JournalHeader::Magic, sizeof(header.magic));
+        memcpy(header.symbol, symbol.data(), std::min(symbol.size(), sizeof(header.symbol)));
+        header.symbolId = symbolId;
+        if (!writeAll(fd, reinterpret_cast<const char*>(&header), sizeof(header)) || (sync && fdatasync(fd) != 0)) {
+            close(fd);
+            throw journalError(path, "write");
+        }
+    } else {
+        records = (static_cast<uint64_t>(st.st_size) - sizeof(JournalHeader)) / sizeof(JournalRecord);
+    }
+    journals.push_back(std::make_unique<InstrumentJournal>(fd, records, path, dir + name + SnapshotSuffix));
+    return journals.back().get();
+}
+
+void JournalWriter::start() {
+    thread = std::thread([this]() { run(); });
+}
+
+void JournalWriter::stopAndJoin() {
+    stop = true;
+    bell.ring();
+    if (thread.joinable()) {
+        if (thread.get_id() == std::this_thread::get_id())
+            thread.detach();
+        else
+            thread.join();
+    }
+}
+
+void JournalWriter::run() {
+    auto hasWork = [this]() {
+        if (stop.load(std::memory_order_relaxed))
+            return true;
+        for (auto& ring : rings)
+            if (ring->tail.load(std::memory_order_acquire) != ring->head.load(std::memory_order_relaxed))
+                return true;
+        std::lock_guard<std::mutex> lock(snapshotsMutex);
+        return !snapshots.empty();
+    };
+    std::vector<std::unique_ptr<BookSnapshot>> taken;
+    while (true) {
+        bool stopping = stop.load(std::memory_order_acquire);
+        // Snapshots first: the records a snapshot covers were appended before it was handed over, so the collect
+        // below is sure to pick them up and they're on disk before the snapshot is
+        {
+            std::lock_guard<std::mutex> lock(snapshotsMutex);
+            taken.swap(snapshots);
+        }
+        bool any = collect();
+        if (any) {
+            writePending();
+            publishDurable();
+        }
+        for (auto& snap : taken)
+            writeSnapshot(*snap);
+        if (!any && taken.empty()) {
+            if (stopping)
+                break;
+            bell.sleepUnless(hasWork);
+        }
+        taken.clear();
+    }
+}
+
+void JournalWriter::writeSnapshot(const BookSnapshot& s) {
+    // It may cover records that never made it to the file, and the old one still matches what's there
+    if (s.journal->failed())
+        return;
+    // Written next to the old one and renamed over it, so there's always one whole snapshot to recover from
+    std::string tmp = s.journal->snapshotPath + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror("[SERVER] snapshot open");
+        return;
+    }
+    bool ok = writeAll(fd, reinterpret_cast<const char*>(&s.header), sizeof(s.header))
+        && writeAll(fd, reinterpret_cast<const char*>(s.levels.data()), s.levels.size() * sizeof(SnapshotLevel))
+        && writeAll(fd, reinterpret_cast<const char*>(s.orders.data()), s.orders.size() * sizeof(SnapshotOrder))
+        && (!sync || fdatasync(fd) == 0);
+    close(fd);
+    if (!ok || rename(tmp.c_str(), s.journal->snapshotPath.c_str()) != 0) {
+        perror("[SERVER] snapshot write");
+        unlink(tmp.c_str());
+        return;
+    }
+    if (sync) {
+        // Makes the rename itself durable
+        int dirFd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+        if (dirFd != -1) {
+            fsync(dirFd);
+            close(dirFd);
+        }
+    }
+}
+
+bool JournalWriter::collect() {
+    bool any = false;
+    for (auto& ring : rings) {
+        size_t from = ring->head.load(std::memory_order_relaxed);
+        size_t upTo = ring->tail.load(std::memory_order_acquire);
+        for (size_t i = from; i != upTo; ++i) {
+            const JournalRing::Entry& e = ring->entries[i & ring->mask];
+            if (e.journal->pending.empty())
+                dirty.push_back(e.journal);
+            e.journal->pending.push_back(e.record);
+            e.journal->pendingAt.push_back(i);
+            e.journal->ring = ring.get();
+        }
+        if (upTo != from) {
+            ring->head.store(upTo, std::memory_order_release);
+            any = true;
+        }
+    }
+    return any;
+}
+
+void JournalWriter::writePending() {
+    for (InstrumentJournal* j : dirty) {
+        // A failed journal takes no more records, only what was already on its way still arrives here
+        if (!j->failed()) {
+            j->unsyncedFrom = j->pendingAt.front();
+            size_t bytes = j->pending.size() * sizeof(JournalRecord);
+            size_t written = writeSome(j->fd, reinterpret_cast<const char*>(j->pending.data()), bytes);
+            if (written == bytes)
+                j->records += j->pending.size();
+            else
+                fail(*j, written / sizeof(JournalRecord), j->pendingAt[written / sizeof(JournalRecord)], "write");
+        }
+        j->pending.clear();
+        j->pendingAt.clear();
+    }
+    // Group commit: one sync per file for everything that came in since the last one
+    if (sync)
+        for (InstrumentJournal* j : dirty)
+            if (!j->failed() && fdatasync(j->fd) != 0)
+                fail(*j, 0, j->unsyncedFrom, "fdatasync");
+    dirty.clear();
+}
+
+void JournalWriter::publishDurable() {
+    // Never past a record a failed journal lost: its book had already acted on that command, and on everything the
+    // shard took after it
+    for (auto& ring : rings) {
+        size_t upTo = std::min(ring->head.load(std::memory_order_relaxed), ring->heldAt);
+        if (upTo == ring->durable.load(std::memory_order_relaxed))
+            continue;
+        ring->durable.store(upTo, std::memory_order_release);
+        if (ring->output)
+            ring->output->publisherBell().ring();
+    }
+}
+
+void JournalWriter::fail(InstrumentJournal& j, uint64_t written, size_t lostAt, const char* what) {
+    int err = errno;
+    j.records += written;
+    // A record cut short would put every one after it out of step, cut the file back to the last whole one so
+    // recovery stops cleanly there
+    off_t whole = static_cast<off_t>(sizeof(JournalHeader) + j.records * sizeof(JournalRecord));
+    bool truncated = ftruncate(j.fd, whole) == 0;
+    j.broken.store(true, std::memory_order_release);
+    // With held output the shard's events from lostAt on never go out, so its other books have to stop too
+    JournalRing& ring = *j.ring;
+    if (ring.output) {
+        ring.heldAt = std::min(ring.heldAt, lostAt);
+        ring.stopped.store(true, std::memory_order_release);
+        ring.output->discardHeld();
+    }
+    fprintf(stderr, "[SERVER] journal %s: %s failed (%s), %" PRIu64 " records kept%s. %s refuses every command "
+            "from now on\n", j.path.c_str(), what, strerror(err), j.records, truncated ? "" : " (truncating it failed too)",
+            ring.output ? "Every book of its shard" : "Its book");
+}
@@ -0,0 +1,276 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CpuRelax.hpp"
+#include "Doorbell.hpp"
+#include "io.hpp"
+
+// Write-ahead journal of the commands each book has been given, so resting orders survive a restart.
+//
+// One append-only file per instrument, <dir>/<packed symbol in hex>.journal: a JournalHeader followed by fixed size
+// JournalRecords, in the order the book saw them. A book is deterministic, so replaying its records into an empty
+// book rebuilds exactly the book that was there, without publishing anything a second time.
+//
+// Matching threads never touch the files. A command is handed to the journal thread through the shard's JournalRing
+// before the book applies it; the journal thread writes whatever has piled up since its last pass, one write() per
+// file, and then fdatasyncs those files once for the whole batch (group commit). The more commands arrive while a
+// sync is in progress, the more the next one covers. With syncing on, a shard's events are held back from the
+// publisher until the group commit covering their commands is done, so a client never sees an acknowledgement a
+// crash could take back. A journal that fails there stops the whole shard's output at its first lost record, and
+// the shard's books refuse every command from then on (see JournalRing::failed).
+//
+// Every so many commands a book also gets a snapshot, <dir>/<packed symbol in hex>.snapshot: its price levels and
+// resting orders as of a journal sequence number (the count of the book's records it covers). The shard thread only
+// copies the book into a BookSnapshot between two commands; the journal thread writes it out (after the journal
+// records it covers), syncs it and renames it over the previous one. Recovery maps the snapshot, rebuilds the book from
+// it and replays only the journal records after its sequence number.
+
+// Native little-endian, 16 bytes
+struct JournalRecord {
+    char     type;          // 'B', 'S', 'C' or 'M'
+    char     reserved[3];
+    uint32_t order_id;
+    uint32_t price;
+    uint32_t count;
+};
+static_assert(sizeof(JournalRecord) == 16, "JournalRecord is a file format");
+
+struct JournalHeader {
+    static constexpr char Magic[8] = {'O', 'B', 'J', 'R', 'N', 'L', '1', '\0'};
+
+    char     magic[8];
+    char     symbol[8];     // NUL padded, not terminated when all 8 characters are used
+    uint32_t symbolId;      // the instrument's id when the journal was created, kept across restarts
+    uint32_t reserved;
+    uint64_t reserved2;
+};
+static_assert(sizeof(JournalHeader) == 32, "JournalHeader is a file format");
+
+// Snapshot file layout: a SnapshotHeader, bidLevels + askLevels SnapshotLevels (bids then asks, best first), then
+// the orders of every level, level by level in that same order and in time priority within a level. Native
+// little-endian, nothing but fixed size records, so a mapped snapshot can be read in place
+struct SnapshotHeader {
+    static constexpr char Magic[8] = {'O', 'B', 'S', 'N', 'A', 'P', '1', '\0'};
+
+    char     magic[8];
+    char     symbol[8];     // NUL padded, not terminated when all 8 characters are used
+    uint32_t symbolId;
+    uint32_t bidLevels;
+    uint32_t askLevels;
+    uint32_t reserved;
+    uint64_t journalSeq;    // journal records the snapshot covers, replay picks up at this record
+    uint64_t orders;
+};
+static_assert(sizeof(SnapshotHeader) == 48, "SnapshotHeader is a file format");
+
+struct SnapshotLevel {
+    uint32_t price;
+    uint32_t orders;
+    uint64_t quantity;
+};
+static_assert(sizeof(SnapshotLevel) == 16, "SnapshotLevel is a file format");
+
+struct SnapshotOrder {
+    uint32_t order_id;
+    uint32_t quantity;
+};
+static_assert(sizeof(SnapshotOrder) == 8, "SnapshotOrder is a file format");
+
+class InstrumentJournal;
+class JournalRing;
+
+// A book copied out by its shard thread, on its way to the journal thread
+struct BookSnapshot {
+    InstrumentJournal* journal;
+    SnapshotHeader header;
+    std::vector<SnapshotLevel> levels;
+    std::vector<SnapshotOrder> orders;
+};
+
+// One instrument's files. Appended to by the journal thread only
+class InstrumentJournal {
+public:
+    InstrumentJournal(int fd, uint64_t records, std::string path, std::string snapshotPath)
+        : fd(fd), records(records), path(std::move(path)), snapshotPath(std::move(snapshotPath)) { }
+    ~InstrumentJournal();
+    InstrumentJournal(const InstrumentJournal&) = delete;
+    InstrumentJournal& operator=(const InstrumentJournal&) = delete;
+
+    // Any thread. Set for good once a write or sync of the file failed: the book must not take any more commands,
+    // they couldn't be journaled
+    bool failed() const { return broken.load(std::memory_order_acquire); }
+
+private:
+    friend class JournalWriter;
+
+    int fd;
+    // Whole records in the file, replayed ones included
+    uint64_t records;
+    // Taken off the rings, not yet written, and where in its ring each of them was appended
+    std::vector<JournalRecord> pending;
+    std::vector<size_t> pendingAt;
+    // The ring this book's shard appends to, and the ring position of the first record not synced yet
+    JournalRing* ring = nullptr;
+    size_t unsyncedFrom = 0;
+    std::string path;
+    std::string snapshotPath;
+    std::atomic<bool> broken{false};
+};
+
+class JournalWriter;
+class OutputRing;
+
+// Single producer (a matching shard) / single consumer (the journal thread) ring of records on their way to disk
+class JournalRing {
+public:
+    explicit JournalRing(JournalWriter& writer, Doorbell& writerBell, size_t capacity = 65536)
+        : writer(writer), bell(writerBell) {
+        size_t cap = 2;
+        while (cap < capacity)
+            cap <<= 1;
+        mask = cap - 1;
+        entries = std::make_unique<Entry[]>(cap);
+    }
+    JournalRing(const JournalRing&) = delete;
+    JournalRing& operator=(const JournalRing&) = delete;
+
+    // Shard thread only
+    void append(InstrumentJournal* journal, const ClientCommand& cmd) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        // Full: the disk is behind, wait for it rather than let the journal miss a command
+        while (t - cachedHead > mask) {
+            cachedHead = head.load(std::memory_order_acquire);
+            if (t - cachedHead > mask)
+                cpuRelax();
+        }
+        Entry& e = entries[t & mask];
+        e.journal = journal;
+        e.record = JournalRecord{static_cast<char>(cmd.type), {}, cmd.order_id, cmd.price, cmd.count};
+        tail.store(t + 1, std::memory_order_release);
+        bell.ring();
+    }
+
+    // Setup, before the shard runs: out hands the publisher events only once the records appended before them are
+    // written (and synced) by a group commit, see OutputRing::holdUntilJournaled
+    void holdOutput(OutputRing& out);
+
+    // Shard thread only, after the append of the last command the snapshot covers
+    void snapshot(std::unique_ptr<BookSnapshot> s);
+    // Commands between two snapshots of a book, 0 for none
+    uint64_t snapshotEvery() const;
+    // Whether records are fdatasynced
+    bool syncs() const;
+    // Any thread. Set for good once a journal of this shard failed while its output was held: the events of the
+    // commands that didn't make it to disk are never let go, and so no other event of the shard's after them either.
+    // Its books refuse every command from then on
+    bool failed() const { return stopped.load(std::memory_order_acquire); }
+
+private:
+    friend class JournalWriter;
+
+    struct Entry {
+        InstrumentJournal* journal;
+        JournalRecord record;
+    };
+
+    static constexpr size_t CacheLine = 64;
+
+    JournalWriter& writer;
+    Doorbell& bell;
+    std::unique_ptr<Entry[]> entries;
+    size_t mask = 0;
+    alignas(CacheLine) std::atomic<size_t> tail{0};
+    size_t cachedHead = 0;
+    alignas(CacheLine) std::atomic<size_t> head{0};
+    // Records written (and synced) so far, moved by the journal thread after each group commit
+    std::atomic<size_t> durable{0};
+    // Journal thread's: durable never goes past this, the first record a failed journal didn't get on disk
+    size_t heldAt = SIZE_MAX;
+    std::atomic<bool> stopped{false};
+    // Held until durable, nullptr unless output is held
+    OutputRing* output = nullptr;
+};
+
+// The journal directory and the thread that writes to it
+class JournalWriter {
+public:
+    // sync: fdatasync every batch. Without it a record is safe from a crash of the engine once written,
+    // but not from one of the machine. snapshotEvery: commands between two snapshots of a book, 0 for none
+    JournalWriter(std::string dir, bool sync, uint64_t snapshotEvery = 0);
+    ~JournalWriter() { stopAndJoin(); }
+    JournalWriter(const JournalWriter&) = delete;
+    JournalWriter& operator=(const JournalWriter&) = delete;
+
+    // A journal recovered from the directory, along with its latest snapshot if there is one: the files mapped read
+    // only, to be replayed and unmapped again
+    struct Recovered {
+        std::string symbol;
+        uint32_t symbolId;
+        const JournalRecord* records;
+        size_t count;
+        void* map;
+        size_t mapBytes;
+        // nullptr without a (usable) snapshot. Otherwise replay starts at records[snapshot->journalSeq]
+        const SnapshotHeader* snapshot = nullptr;
+        const SnapshotLevel* levels = nullptr;
+        const SnapshotOrder* orders = nullptr;
+        void* snapshotMap = nullptr;
+        size_t snapshotBytes = 0;
+    };
+    // Every journal in the directory, in symbolId order. A record cut short by a crash is dropped (and cut off the
+    // file), a snapshot that doesn't add up is ignored. Throws std::runtime_error on a file that isn't a journal
+    std::vector<Recovered> recover();
+    static void release(Recovered& r);
+
+    // Before start(), one per matching shard
+    JournalRing& createRing();
+    // Opens (creating it if needed) the instrument's journal for appending. Slow path, callers serialize it
+    InstrumentJournal* open(const std::string& symbol, uint32_t symbolId);
+
+    void start();
+    // Writes (and syncs) everything appended so far, then stops the thread
+    void stopAndJoin();
+
+    const std::string& directory() const { return dir; }
+    bool syncs() const { return sync; }
+    uint64_t snapshotEvery() const { return everyCommands; }
+
+private:
+    friend class JournalRing;
+
+    void run();
+    void writeSnapshot(const BookSnapshot& s);
+    // Moves everything on the rings to the journals' pending lists, returns whether there was anything
+    bool collect();
+    void writePending();
+    // Tells each ring (and its held output) that everything taken off it is on disk now
+    void publishDurable();
+    // Gives up on j after a failed write or sync (with errno still set), written: whole records of the failed write
+    // that did make it out, lostAt: ring position of the first record that isn't on disk
+    void fail(InstrumentJournal& j, uint64_t written, size_t lostAt, const char* what);
+
+    std::string dir;
+    bool sync;
+    uint64_t everyCommands;
+
+    std::thread thread;
+    std::atomic<bool> stop{false};
+    Doorbell bell;
+
+    std::vector<std::unique_ptr<JournalRing>> rings;
+    std::vector<std::unique_ptr<InstrumentJournal>> journals;
+
+    // Handed over by the shard threads, written after the journal records they cover
+    std::mutex snapshotsMutex;
+    std::vector<std::unique_ptr<BookSnapshot>> snapshots;
+
+    // Journal thread only
+    std::vector<InstrumentJournal*> dirty;
+};
@@ -0,0 +1,138 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// HDR style latency histogram: 32 linear sub-buckets per power of two, so any recorded value is reported
+// within ~3% of what it was, from 1ns up to the full 64 bit range, in a fixed 15 KiB of counters.
+//
+// One thread records into a histogram (a plain load + store per counter, no locked instruction),
+// any thread may take a snapshot of it at any time. A snapshot taken while recording may be off by the few
+// values being recorded right then, that's fine for percentiles.
+class LatencyHistogram {
+public:
+    static constexpr unsigned SubBits = 5;
+    static constexpr uint64_t SubCount = uint64_t(1) << SubBits;
+    static constexpr size_t BucketCount = (64 - SubBits + 1) * SubCount;
+
+    // Counts copied out of a histogram, snapshots of several histograms can be added up
+    struct Snapshot {
+        std::vector<uint64_t> counts = std::vector<uint64_t>(BucketCount);
+        uint64_t total = 0;
+        uint64_t max = 0;
+
+        void add(const Snapshot& other) {
+            for (size_t i = 0; i < BucketCount; ++i)
+                counts[i] += other.counts[i];
+            total += other.total;
+            max = std::max(max, other.max);
+        }
+
+        // Smallest value that at least q (0..1) of the recorded values are less than or equal to,
+        // reported as the top of its bucket
+        uint64_t percentile(double q) const {
+            if (total == 0)
+                return 0;
+            uint64_t rank = static_cast<uint64_t>(q * total + 0.5);
+            rank = std::max<uint64_t>(rank, 1);
+            uint64_t seen = 0;
+            for (size_t i = 0; i < BucketCount; ++i) {
+                seen += counts[i];
+                if (seen >= rank)
+                    return std::min(bucketTop(i), max);
+            }
+            return max;
+        }
+    };
+
+    void record(uint64_t value) {
+        std::atomic<uint64_t>& bucket = buckets[bucketOf(value)];
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        if (value > maxValue.load(std::memory_order_relaxed))
+            maxValue.store(value, std::memory_order_relaxed);
+    }
+
+    Snapshot snapshot() const {
+        Snapshot s;
+        for (size_t i = 0; i < BucketCount; ++i) {
+            s.counts[i] = buckets[i].load(std::memory_order_relaxed);
+            s.total += s.counts[i];
+        }
+        s.max = maxValue.load(std::memory_order_relaxed);
+        return s;
+    }
+
+    static size_t bucketOf(uint64_t v) {
+        if (v < SubCount)
+            return v;
+        unsigned shift = 63 - __builtin_clzll(v) - SubBits;
+        return (shift + 1) * SubCount + ((v >> shift) - SubCount);
+    }
+
+    // Largest value that lands in bucket i
+    static uint64_t bucketTop(size_t i) {
+        if (i < SubCount)
+            return i;
+        unsigned shift = i / SubCount - 1;
+        uint64_t low = (SubCount + i % SubCount) << shift;
+        return low + ((uint64_t(1) << shift) - 1);
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, BucketCount> buckets{};
+    std::atomic<uint64_t> maxValue{0};
+};
+
+// Where a command's time goes between the socket and stdout, one histogram per stage, one set per instrument
+// (except publish, which is kept per matching shard). All values in nanoseconds.
+class LatencyStats {
+public:
+    enum Stage {
+        Ingest,   // socket read -> pushed onto the worker's queue (parse, routing)
+        Queue,    // pushed -> popped by the shard (stamped once per batch of commands popped together)
+        Match,    // popped -> matched and its events written to the output ring (so includes the batch ahead of it)
+        Publish,  // event published -> written out by the publisher (per event)
+        Total,    // socket read -> matched
+        StageCount
+    };
+
+    static const char* stageName(Stage s) {
+        switch (s) {
+            case Ingest:  return "ingest";
+            case Queue:   return "queue";
+            case Match:   return "match";
+            case Publish: return "publish";
+            case Total:   return "total";
+            default:      return "?";
+        }
+    }
+
+    LatencyHistogram& operator[](Stage s) { return stages[s]; }
+    const LatencyHistogram& operator[](Stage s) const { return stages[s]; }
+
+    // Worker thread, once per command: read / enqueue stamps come with the command, dequeued / done are its own
+    void recordCommand(int64_t read, int64_t enqueued, int64_t dequeued, int64_t done) {
+        stages[Ingest].record(delta(read, enqueued));
+        stages[Queue].record(delta(enqueued, dequeued));
+        stages[Match].record(delta(dequeued, done));
+        stages[Total].record(delta(read, done));
+    }
+
+    // One line per stage: count and p50 / p99 / p99.9 / max
+    static void print(std::ostream& out, const char* name, Stage s, const LatencyHistogram::Snapshot& snap);
+
+    static uint64_t delta(int64_t from, int64_t to) { return to > from ? static_cast<uint64_t>(to - from) : 0; }
+
+private:
+    std::array<LatencyHistogram, StageCount> stages;
+};
+
+inline void LatencyStats::print(std::ostream& out, const char* name, Stage s, const LatencyHistogram::Snapshot& snap) {
+    out << "[LATENCY] " << name << ' ' << stageName(s) << " count=" << snap.total
+        << " p50=" << snap.percentile(0.5) << " p99=" << snap.percentile(0.99)
+        << " p99.9=" << snap.percentile(0.999) << " max=" << snap.max << " ns\n";
+}
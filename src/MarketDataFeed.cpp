@@ -0,0 +1,136 @@
+#include "MarketDataFeed.hpp"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+std::runtime_error feedError(const std::string& name, const char* what) {
+    return std::runtime_error("market data feed " + name + ": " + what + ": " + strerror(errno));
+}
+
+} // namespace
+
+MarketDataFeed::MarketDataFeed(const std::string& name, uint32_t ringCount, uint32_t depth, uint64_t capacity)
+    : snapshotDepth(depth) {
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+        throw std::runtime_error("market data feed " + name + ": ring capacity must be a power of two");
+
+    // A fresh segment every time instead of truncating the old one: readers still attached to a previous run keep
+    // their (now stale) mapping rather than seeing it zeroed under them
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd == -1)
+        throw feedError(name, "shm_open");
+    bytes = MarketDataLayout::totalBytes(ringCount, capacity);
+    // ftruncate zero fills, so every slot starts with sequence 0 (nothing written)
+    if (ftruncate(fd, static_cast<off_t>(bytes)) != 0) {
+        close(fd);
+        shm_unlink(name.c_str());
+        throw feedError(name, "ftruncate");
+    }
+    base = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        base = nullptr;
+        shm_unlink(name.c_str());
+        throw feedError(name, "mmap");
+    }
+
+    char* p = static_cast<char*>(base) + sizeof(MarketDataLayout::Header);
+    rings.reserve(ringCount);
+    for (uint32_t i = 0; i < ringCount; ++i, p += MarketDataLayout::ringBytes(capacity)) {
+        auto* header = reinterpret_cast<MarketDataLayout::RingHeader*>(p);
+        auto* slots = reinterpret_cast<MarketDataLayout::Slot*>(p + sizeof(MarketDataLayout::RingHeader));
+        rings.emplace_back(header, slots, capacity);
+    }
+
+    auto* header = static_cast<MarketDataLayout::Header*>(base);
+    header->rings = ringCount;
+    header->depth = depth;
+    header->capacity = capacity;
+    // Magic last, a reader that sees it sees the rest of the header
+    header->magic.store(MarketDataLayout::Magic, std::memory_order_release);
+}
+
+MarketDataFeed::~MarketDataFeed() {
+    if (base)
+        munmap(base, bytes);
+}
+
+MarketDataReader::MarketDataReader(const std::string& name) {
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd == -1)
+        throw feedError(name, "shm_open");
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw feedError(name, "fstat");
+    }
+    bytes = static_cast<size_t>(st.st_size);
+    if (bytes < sizeof(MarketDataLayout::Header)) {
+        close(fd);
+        throw std::runtime_error("market data feed " + name + ": not a market data feed");
+    }
+    base = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        base = nullptr;
+        throw feedError(name, "mmap");
+    }
+
+    auto* header = static_cast<const MarketDataLayout::Header*>(base);
+    if (header->magic.load(std::memory_order_acquire) != MarketDataLayout::Magic || header->capacity == 0
+        || bytes < MarketDataLayout::totalBytes(header->rings, header->capacity)) {
+        munmap(base, bytes);
+        base = nullptr;
+        throw std::runtime_error("market data feed " + name + ": not a market data feed (or not set up yet)");
+    }
+    capacity = header->capacity;
+    snapshotDepth = header->depth;
+    positions.resize(header->rings);
+    // Start from now, whatever is already in the rings may be partly overwritten
+    for (size_t i = 0; i < positions.size(); ++i)
+        positions[i] = ringHeader(i)->writePos.load(std::memory_order_acquire);
+}
+
+MarketDataReader::~MarketDataReader() {
+    if (base)
+        munmap(base, bytes);
+}
+
+MarketDataLayout::RingHeader* MarketDataReader::ringHeader(size_t i) const {
+    char* p = static_cast<char*>(base) + sizeof(MarketDataLayout::Header) + i * MarketDataLayout::ringBytes(capacity);
+    return reinterpret_cast<MarketDataLayout::RingHeader*>(p);
+}
+
+MarketDataLayout::Slot* MarketDataReader::ringSlots(size_t i) const {
+    return reinterpret_cast<MarketDataLayout::Slot*>(reinterpret_cast<char*>(ringHeader(i)) + sizeof(MarketDataLayout::RingHeader));
+}
+
+MarketDataReader::Result MarketDataReader::poll(size_t i, MarketDataEvent& out) {
+    uint64_t pos = positions[i];
+    const MarketDataLayout::Slot& slot = ringSlots(i)[pos & (capacity - 1)];
+    uint64_t seq = slot.seq.load(std::memory_order_acquire);
+    // Below: still the previous lap's record, or this one is being written right now
+    if (seq < 2 * pos + 2)
+        return Result::Empty;
+    if (seq == 2 * pos + 2) {
+        uint64_t words[MarketDataLayout::Words];
+        for (size_t w = 0; w < MarketDataLayout::Words; ++w)
+            words[w] = slot.words[w].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) == seq) {
+            memcpy(&out, words, sizeof(out));
+            positions[i] = pos + 1;
+            return Result::Event;
+        }
+    }
+    // The writer is at least a whole ring ahead, catch up with it
+    positions[i] = ringHeader(i)->writePos.load(std::memory_order_acquire);
+    return Result::Lost;
+}
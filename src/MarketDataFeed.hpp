@@ -0,0 +1,134 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// L2 market data in shared memory: aggregated price levels (total quantity and order count) as the books change,
+// plus periodic top-N depth snapshots, so local consumers don't have to rebuild depth from the per order events.
+//
+// The segment (shm_open name, e.g. /orderbook-md) holds one ring per matching shard. Each ring has exactly one
+// writer, the shard thread, and any number of readers in any process. Readers never block the writer and the writer
+// never waits for readers: a reader that falls more than a ring behind notices and skips ahead (and then waits for
+// the next snapshot of each instrument to be in sync again).
+//
+// Every slot carries a sequence number next to its record. Position p of a ring is being written while the slot's
+// sequence is 2p + 1 and complete once it's 2p + 2. A reader copies the record and checks the sequence didn't move.
+
+// One market data record. Native little-endian, 40 bytes
+struct MarketDataEvent {
+    char     type;          // 'U' level update, 'S' snapshot start, 'L' snapshot level, 'E' snapshot end
+    char     side;          // 'U' / 'L': 'B' or 'S'
+    uint16_t reserved;
+    uint32_t symbolId;      // dense instrument id, see InstrumentWorker::symbolId
+    uint32_t price;         // 'U' / 'L'
+    uint32_t orders;        // 'U' / 'L': resting orders at the level, 0 when the level is gone
+    uint64_t quantity;      // 'U' / 'L': total resting quantity at the level
+    char     symbol[8];     // NUL padded, not terminated when all 8 characters are used
+    int64_t  timestamp;
+};
+static_assert(sizeof(MarketDataEvent) == 40, "MarketDataEvent is a shared memory format");
+
+struct MarketDataLayout {
+    static constexpr uint64_t Magic = 0x314446444d424f4full;  // "OBMDFD1"
+    static constexpr size_t Words = sizeof(MarketDataEvent) / sizeof(uint64_t);
+
+    struct Header {
+        std::atomic<uint64_t> magic;  // stored last
+        uint32_t rings;
+        uint32_t depth;      // levels per side in a snapshot
+        uint64_t capacity;   // slots per ring, a power of two
+        char     pad[40];
+    };
+
+    struct Slot {
+        std::atomic<uint64_t> seq;
+        std::atomic<uint64_t> words[Words];
+    };
+
+    struct alignas(64) RingHeader {
+        std::atomic<uint64_t> writePos;  // next position the writer will fill
+    };
+
+    static size_t ringBytes(uint64_t capacity) { return sizeof(RingHeader) + capacity * sizeof(Slot); }
+    static size_t totalBytes(uint32_t rings, uint64_t capacity) { return sizeof(Header) + rings * ringBytes(capacity); }
+};
+static_assert(sizeof(MarketDataLayout::Header) == 64, "keeps the rings cache line aligned");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "atomics in shared memory must be lock free");
+
+// Writer end of one ring, used by a single thread
+class MarketDataRing {
+public:
+    MarketDataRing(MarketDataLayout::RingHeader* header, MarketDataLayout::Slot* slots, uint64_t capacity)
+        : header(header), slots(slots), mask(capacity - 1) { }
+
+    void publish(const MarketDataEvent& e) {
+        MarketDataLayout::Slot& slot = slots[pos & mask];
+        uint64_t words[MarketDataLayout::Words];
+        memcpy(words, &e, sizeof(e));
+        slot.seq.store(2 * pos + 1, std::memory_order_relaxed);
+        // Readers that see any of the new words must also see the odd sequence
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < MarketDataLayout::Words; ++i)
+            slot.words[i].store(words[i], std::memory_order_relaxed);
+        slot.seq.store(2 * pos + 2, std::memory_order_release);
+        ++pos;
+        header->writePos.store(pos, std::memory_order_release);
+    }
+
+private:
+    MarketDataLayout::RingHeader* header;
+    MarketDataLayout::Slot* slots;
+    uint64_t mask;
+    uint64_t pos = 0;
+};
+
+// Creates (or replaces) the shared memory segment, engine side
+class MarketDataFeed {
+public:
+    // Throws std::runtime_error when the segment can't be set up
+    MarketDataFeed(const std::string& name, uint32_t rings, uint32_t depth, uint64_t capacity = 65536);
+    ~MarketDataFeed();
+    MarketDataFeed(const MarketDataFeed&) = delete;
+    MarketDataFeed& operator=(const MarketDataFeed&) = delete;
+
+    MarketDataRing& ring(size_t i) { return rings[i]; }
+    uint32_t depth() const { return snapshotDepth; }
+
+private:
+    void* base = nullptr;
+    size_t bytes = 0;
+    uint32_t snapshotDepth;
+    std::vector<MarketDataRing> rings;
+};
+
+// Reader end, for consumers (any process). Follows every ring of the segment from its current write position
+class MarketDataReader {
+public:
+    // Throws std::runtime_error when the segment isn't there or isn't a market data feed
+    explicit MarketDataReader(const std::string& name);
+    ~MarketDataReader();
+    MarketDataReader(const MarketDataReader&) = delete;
+    MarketDataReader& operator=(const MarketDataReader&) = delete;
+
+    enum class Result { Event, Empty, Lost };
+
+    // Next record of ring i. Lost: the writer lapped this reader, it has been moved up to the writer and some
+    // updates are gone, wait for the next snapshot of each instrument
+    Result poll(size_t i, MarketDataEvent& out);
+
+    size_t ringCount() const { return positions.size(); }
+    uint32_t depth() const { return snapshotDepth; }
+
+private:
+    MarketDataLayout::RingHeader* ringHeader(size_t i) const;
+    MarketDataLayout::Slot* ringSlots(size_t i) const;
+
+    void* base = nullptr;
+    size_t bytes = 0;
+    uint64_t capacity = 0;
+    uint32_t snapshotDepth = 0;
+    std::vector<uint64_t> positions;
+};
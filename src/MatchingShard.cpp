@@ -0,0 +1,113 @@
+#include "MatchingShard.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+#include "Affinity.hpp"
+#include "engine.hpp"
+#include "InstrumentWorker.hpp"
+
+MatchingShard::MatchingShard(size_t index, OutputPublisher& publisher, WaitStrategy wait, int cpu, bool trackLatency,
+                             MarketDataRing* marketData, uint32_t marketDataDepth, JournalRing* journal, bool cancelLane)
+    : shardIndex(index), cpu(cpu), publisher(publisher), ring(publisher.createRing(trackLatency ? &publishLatency : nullptr)),
+      mdRing(marketData), mdDepth(marketDataDepth), journalRing(journal), wait(wait), queue(QueueCapacity, wait, &doorbell) {
+    // Write-ahead all the way to the client: nothing is acknowledged before its command is on disk
+    if (journal && journal->syncs())
+        journal->holdOutput(ring);
+    if (cancelLane)
+        cancels = std::make_unique<MpscRing<CancelTask>>(CancelCapacity, wait, &doorbell);
+}
+
+void MatchingShard::start() {
+    thread = std::thread([this]() { run(); });
+}
+
+void MatchingShard::stopAndJoin() {
+    stop = true;
+    if (thread.joinable()) {
+        // Unblock the thread if it's waiting on an empty queue
+        queue.push(Task{nullptr, ClientCommand(), 0});
+        thread.join();
+    }
+}
+
+void MatchingShard::run() {
+    if (!pinThisThread(cpu))
+        SyncCerr() << "[SERVER] could not pin matching shard " << shardIndex << " to cpu " << cpu << std::endl;
+    try {
+        for (auto& task : startup)
+            task();
+        startup.clear();
+    } catch (...) {
+        ready.set_exception(std::current_exception());
+        return;
+    }
+    ready.set_value();
+    try {
+        while (!stop) {
+            // Block until a command is available, then take whatever else is already queued behind it
+            size_t n = 0;
+            if (!cancels) {
+                batch[0] = queue.wait_pop();
+                n = 1;
+            } else if (queue.empty() && cancels->empty()) {
+                waitForWork();
+                continue;
+            }
+            while (n < MaxBatch && queue.try_pop(batch[n]))
+                ++n;
+            // One clock read for the whole batch, and its events reach the publisher in one go
+            int64_t dequeued = getCurrentTimestamp();
+            ring.beginBatch();
+            size_t first = queue.consumed() - n;
+            for (size_t i = 0; i < n; ++i) {
+                // Cancels first, but none later than where it would have been in the main queue: not after a
+                // command pushed behind it, and no deferred one past its place
+                if (cancels && (cancels->consumed() < batch[i].cancelsBefore || first + i >= deferredUntil))
+                    drainCancels(first + i, dequeued);
+                if (batch[i].worker)
+                    batch[i].worker->process(batch[i].cmd, dequeued);
+            }
+            if (cancels)
+                drainCancels(first + n, dequeued);
+            ring.endBatch();
+        }
+    } catch (const std::exception& ex) {
+        SyncCerr() << "Exception in matching shard " << shardIndex << ": " << ex.what() << std::endl;
+    } catch (...) {
+        SyncCerr() << "Unknown exception in matching shard " << shardIndex << std::endl;
+    }
+}
+
+void MatchingShard::drainCancels(size_t done, int64_t dequeued) {
+    // Deferred ones simply wait for their place in the main queue, earliest first and in lane order among equals
+    while (!deferred.empty() && done >= deferred.front().task.after) {
+        std::pop_heap(deferred.begin(), deferred.end());
+        deferred.back().task.worker->process(deferred.back().task.cmd, dequeued);
+        deferred.pop_back();
+    }
+    // Everything pushed to the main queue before a cancel is below its `after`, its own order included
+    CancelTask c;
+    for (size_t n = 0; n < CancelCapacity && cancels->try_pop(c); ++n) {
+        if (done >= c.after || c.worker->cancelMayJump(c.cmd.order_id)) {
+            c.worker->process(c.cmd, dequeued);
+        } else {
+            deferred.push_back(Deferred{c, cancels->consumed()});
+            std::push_heap(deferred.begin(), deferred.end());
+        }
+    }
+    deferredUntil = deferred.empty() ? SIZE_MAX : deferred.front().task.after;
+}
+
+void MatchingShard::waitForWork() {
+    // Deferred cancels need the main queue to move, so they don't count
+    auto hasWork = [this] { return !queue.empty() || !cancels->empty(); };
+    for (unsigned spins = 0; !hasWork(); ++spins) {
+        if (wait == WaitStrategy::BusySpin || spins < SpinLimit)
+            cpuRelax();
+        else if (wait == WaitStrategy::SpinYield)
+            std::this_thread::yield();
+        else
+            doorbell.sleepUnless(hasWork);
+    }
+}
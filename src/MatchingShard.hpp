@@ -0,0 +1,131 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "io.hpp"
+#include "Journal.hpp"
+#include "LatencyStats.hpp"
+#include "MarketDataFeed.hpp"
+#include "MpscRing.hpp"
+#include "OutputPublisher.hpp"
+
+class InstrumentWorker;
+
+// One matching thread of the engine's fixed pool. Instruments are assigned to shards when they're first seen and a
+// shard runs the books of all its instruments off a single inbound queue, so the number of threads no longer grows
+// with the number of symbols. Commands of one instrument always go through the same queue and keep their order.
+//
+// With a cancel lane, cancels go through a second queue instead, which the thread checks before every command it
+// takes off the main one, so a cancel doesn't wait behind a burst of new orders while its order gets filled. A
+// cancel never overtakes its own order: one whose order isn't resting yet, or that arrives while an amend of the
+// instrument is queued, is held back until the main queue has got past every command queued before the cancel was.
+// Per client, new orders keep their order and a cancel is never applied before anything the client sent earlier for
+// the same order, but it may be applied before earlier orders for other ones.
+class MatchingShard {
+public:
+    // cpu >= 0 pins the thread to that core. With trackLatency the publisher records the publish stage of this
+    // shard's events into publishLatency. marketData / journal: this shard's ring of the L2 feed / the journal, if any
+    MatchingShard(size_t index, OutputPublisher& publisher, WaitStrategy wait, int cpu = -1, bool trackLatency = false,
+                  MarketDataRing* marketData = nullptr, uint32_t marketDataDepth = 0, JournalRing* journal = nullptr,
+                  bool cancelLane = false);
+    ~MatchingShard() { stopAndJoin(); }
+    MatchingShard(const MatchingShard&) = delete;
+    MatchingShard& operator=(const MatchingShard&) = delete;
+
+    // Before start(): work the thread does before it takes any command, like rebuilding a book from the journal so
+    // its memory is first touched on this shard's core
+    void beforeServing(std::function<void()> task) { startup.push_back(std::move(task)); }
+    void start();
+    // Until the beforeServing work is done, rethrows what it threw
+    void waitUntilServing() { serving.get(); }
+    void stopAndJoin();
+
+    // Any thread
+    void push(InstrumentWorker* worker, const ClientCommand& cmd) { queue.push(Task{worker, cmd, cancels ? cancels->claimed() : 0}); }
+    // Any thread. On the cancel lane if there is one
+    void pushCancel(InstrumentWorker* worker, const ClientCommand& cmd) {
+        if (cancels)
+            cancels->push(CancelTask{worker, cmd, queue.claimed()});
+        else
+            push(worker, cmd);
+    }
+
+    size_t index() const { return shardIndex; }
+    const LatencyHistogram& publishStage() const { return publishLatency; }
+
+    // Shared by every book on this shard, only ever written from the shard thread
+    OutputRing& output() { return ring; }
+    // For the few events that must not wait behind the ring, see JournalRing::failed
+    OutputPublisher& sharedOutput() { return publisher; }
+    // Same for the market data ring, nullptr without a feed. Snapshots carry up to marketDataDepth() levels per side
+    MarketDataRing* marketData() { return mdRing; }
+    uint32_t marketDataDepth() const { return mdDepth; }
+    // Same for the journal, nullptr when the engine runs without one
+    JournalRing* journal() { return journalRing; }
+
+private:
+    static constexpr size_t QueueCapacity = 16384;
+    static constexpr size_t CancelCapacity = 4096;
+    // Most commands taken off the queue (and stamped) at once
+    static constexpr size_t MaxBatch = 256;
+    static constexpr unsigned SpinLimit = 1024;
+
+    struct Task {
+        InstrumentWorker* worker;  // nullptr only to wake the thread up for stopping
+        ClientCommand cmd;
+        size_t cancelsBefore;      // cancel lane positions claimed when the command was pushed
+    };
+
+    struct CancelTask {
+        InstrumentWorker* worker;
+        ClientCommand cmd;
+        size_t after;  // main queue positions claimed when the cancel was pushed
+    };
+
+    // A cancel held back, in a min-heap on its place in the main queue
+    struct Deferred {
+        CancelTask task;
+        size_t lane;   // its place in the cancel lane
+        bool operator<(const Deferred& other) const {
+            return task.after != other.task.after ? task.after > other.task.after : lane > other.lane;
+        }
+    };
+
+    void run();
+    // Applies every cancel that may go once done commands of the main queue are processed, deferred ones first, and
+    // defers the rest
+    void drainCancels(size_t done, int64_t dequeued);
+    // With a cancel lane, until either queue has something
+    void waitForWork();
+
+    size_t shardIndex;
+    int cpu;
+    LatencyHistogram publishLatency;
+    OutputPublisher& publisher;
+    OutputRing& ring;
+    MarketDataRing* mdRing;
+    uint32_t mdDepth;
+    JournalRing* journalRing;
+    WaitStrategy wait;
+    // Shared by both queues, so the thread can sleep until either has something
+    Doorbell doorbell;
+    MpscRing<Task> queue;
+    // nullptr without a cancel lane
+    std::unique_ptr<MpscRing<CancelTask>> cancels;
+    // Shard thread only
+    Task batch[MaxBatch];
+    std::vector<Deferred> deferred;
+    // Lowest `after` of the deferred cancels
+    size_t deferredUntil = SIZE_MAX;
+    std::vector<std::function<void()>> startup;
+    std::promise<void> ready;
+    std::future<void> serving = ready.get_future();
+    std::atomic<bool> stop{false};
+    std::thread thread;
+};
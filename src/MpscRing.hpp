@@ -0,0 +1,137 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+
+#include "Doorbell.hpp"
+
+// How the consumer of an MpscRing waits when the ring is empty
+enum class WaitStrategy {
+    BusySpin,   // never leaves the core, lowest latency, burns a full CPU per consumer
+    SpinYield,  // spins for a while then sched_yield()s between polls
+    SpinFutex   // spins for a while then sleeps on a futex that producers only touch when the consumer is asleep
+};
+
+// Bounded lock-free multi producer / single consumer ring, meant to replace ThreadSafeQueue on the order path.
+// Each cell carries a sequence number (Vyukov's bounded queue): producers claim a slot with one CAS on the tail,
+// write the value and publish it by bumping the cell's sequence; the consumer owns the head outright.
+// No mutex and, unless the consumer is actually asleep, no syscall on either side.
+template<typename T>
+class MpscRing {
+public:
+    // capacity is rounded up to a power of two. A consumer that waits on several rings at once gives them all the
+    // same doorbell (and then does its own waiting instead of wait_pop)
+    explicit MpscRing(size_t capacity = 4096, WaitStrategy wait = WaitStrategy::SpinFutex, Doorbell* sharedDoorbell = nullptr)
+        : doorbell(sharedDoorbell ? sharedDoorbell : &ownDoorbell), waitStrategy(wait) {
+        size_t cap = 2;
+        while (cap < capacity)
+            cap <<= 1;
+        mask = cap - 1;
+        cells = std::make_unique<Cell[]>(cap);
+        for (size_t i = 0; i < cap; ++i)
+            cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    // The cells hold atomics and the consumer may be parked on the doorbell, so no copying or moving
+    MpscRing(const MpscRing&) = delete;
+    MpscRing& operator=(const MpscRing&) = delete;
+
+    size_t capacity() const { return mask + 1; }
+
+    // Positions claimed by producers so far, any thread: every push that returned before the call is below it
+    size_t claimed() const { return tail.load(std::memory_order_acquire); }
+    // Positions popped so far, consumer only
+    size_t consumed() const { return head; }
+
+    // Returns false when the ring is full
+    bool try_push(const T& value) {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[pos & mask];
+            size_t seq = cell.seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                // slot is free for this lap, try to claim it
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                // consumer hasn't freed this slot from the previous lap yet
+                return false;
+            } else {
+                // another producer got here first
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+        Cell& cell = cells[pos & mask];
+        cell.value = value;
+        cell.seq.store(pos + 1, std::memory_order_release);
+        wakeConsumer();
+        return true;
+    }
+
+    // Blocks (spinning, then yielding) while the ring is full, so a slow consumer back-pressures its producers
+    void push(const T& value) {
+        for (unsigned spins = 0; !try_push(value); ++spins) {
+            if (spins >= SpinLimit)
+                std::this_thread::yield();
+        }
+    }
+
+    // Single consumer only. Returns false if nothing is published yet
+    bool try_pop(T& result) {
+        Cell& cell = cells[head & mask];
+        size_t seq = cell.seq.load(std::memory_order_acquire);
+        if (seq != head + 1)
+            return false;
+        result = std::move(cell.value);
+        // hand the slot back to producers for the next lap
+        cell.seq.store(head + mask + 1, std::memory_order_release);
+        ++head;
+        return true;
+    }
+
+    // Single consumer only. Waits according to the ring's WaitStrategy
+    T wait_pop() {
+        T result;
+        for (unsigned spins = 0; !try_pop(result); ++spins) {
+            if (waitStrategy == WaitStrategy::BusySpin || spins < SpinLimit)
+                continue;
+            if (waitStrategy == WaitStrategy::SpinYield)
+                std::this_thread::yield();
+            else
+                doorbell->sleepUnless([this] { return !empty(); });
+        }
+        return result;
+    }
+
+    // Only meaningful from the consumer
+    bool empty() const {
+        return cells[head & mask].seq.load(std::memory_order_acquire) != head + 1;
+    }
+
+private:
+    static constexpr unsigned SpinLimit = 1024;
+    static constexpr size_t CacheLine = 64;
+
+    struct Cell {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    void wakeConsumer() {
+        if (waitStrategy == WaitStrategy::SpinFutex)
+            doorbell->ring();
+    }
+
+    // Producers hammer the tail, the consumer owns the head: keep them (and the read-mostly fields) on separate lines
+    alignas(CacheLine) std::atomic<size_t> tail{0};
+    alignas(CacheLine) size_t head = 0;
+    alignas(CacheLine) Doorbell ownDoorbell;
+    alignas(CacheLine) std::unique_ptr<Cell[]> cells;
+    Doorbell* doorbell;
+    size_t mask = 0;
+    WaitStrategy waitStrategy;
+};
@@ -0,0 +1,261 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "io.hpp"
+#include "OrderPool.hpp"
+#include "OrderIndex.hpp"
+#include "BookSide.hpp"
+
+// The matching core of one instrument: price-time priority, synchronous and single threaded.
+// No threads, queues, sockets or stdout in here, so it can be benchmarked on its own or embedded
+// (InstrumentWorker runs one on a matching shard thread, a simulator can call it directly).
+//
+// Everything the book does is reported to the Sink, any type with these members:
+//
+//   void OrderAdded(uint32_t id, const char* symbol, uint32_t price, uint32_t count, bool is_sell_side, int64_t ts);
+//   void OrderExecuted(uint32_t resting_id, uint32_t new_id, uint32_t execution_id, uint32_t price, uint32_t count, int64_t ts);
+//   void OrderDeleted(uint32_t id, bool cancel_accepted, int64_t ts);
+//   // An amend: accepted with the order's new price and what of it rests there now (0: filled or amended away),
+//   // rejected (unknown id) with the price and count asked for
+//   void OrderAmended(uint32_t id, bool accepted, uint32_t price, uint32_t count, int64_t ts);
+//   // id isn't live in the book anymore: filled, cancelled, or an incoming order that never rested
+//   void OrderRemoved(uint32_t id);
+//   // New totals of a price level after a command changed it (orders == 0: the level is gone).
+//   // A sweep through a level reports it once, after the last fill there
+//   void LevelChanged(bool is_sell_side, uint32_t price, uint64_t quantity, uint32_t orders, int64_t ts);
+//
+// The first four are the same calls as OutputRing's. Events are stamped with the ts passed to the command.
+template<typename Sink>
+class OrderBook {
+public:
+    OrderBook(std::string symbol, Sink& sink, const std::optional<LadderConfig>& ladder = std::nullopt)
+        : symbol(std::move(symbol)), sink(sink), buyMap(ladder), sellMap(ladder) { }
+    OrderBook(const OrderBook&) = delete;
+    OrderBook& operator=(const OrderBook&) = delete;
+
+    void buy(uint32_t id, uint32_t price, uint32_t count, int64_t ts) { add<true>(id, price, count, ts); }
+    void sell(uint32_t id, uint32_t price, uint32_t count, int64_t ts) { add<false>(id, price, count, ts); }
+    void cancel(uint32_t id, int64_t ts);
+    // Changes a resting order to count at price. Smaller at the same price it keeps its time priority, otherwise it
+    // goes to the back of the new level, after matching whatever it crosses at a new price: a cancel and a new order
+    // under the same id, in one step. count 0 takes it out of the book
+    void amend(uint32_t id, uint32_t price, uint32_t count, int64_t ts);
+
+    // Dispatches on cmd.type, unknown types are ignored
+    void apply(const ClientCommand& cmd, int64_t ts) {
+        switch (cmd.type) {
+            case input_buy:
+                buy(cmd.order_id, cmd.price, cmd.count, ts);
+                break;
+            case input_sell:
+                sell(cmd.order_id, cmd.price, cmd.count, ts);
+                break;
+            case input_cancel:
+                cancel(cmd.order_id, ts);
+                break;
+            case input_amend:
+                amend(cmd.order_id, cmd.price, cmd.count, ts);
+                break;
+            default:
+                break;
+        }
+    }
+
+    const std::string& instrument() const { return symbol; }
+    size_t liveOrders() const { return orderMap.size(); }
+    bool resting(uint32_t id) const { return orderMap.find(id) != NullOrder; }
+    std::optional<uint32_t> bestBid() const { return buyMap.empty() ? std::nullopt : std::optional<uint32_t>(buyMap.bestPrice()); }
+    std::optional<uint32_t> bestAsk() const { return sellMap.empty() ? std::nullopt : std::optional<uint32_t>(sellMap.bestPrice()); }
+
+    // L2 view: the best n levels of each side, bids first, best first. f(is_sell_side, price, quantity, orders)
+    template<typename F>
+    void depth(size_t n, F&& f) {
+        buyMap.forBest(n, [&](uint32_t price, const PriceLevel& lvl) { f(false, price, lvl.quantity, lvl.orders); });
+        sellMap.forBest(n, [&](uint32_t price, const PriceLevel& lvl) { f(true, price, lvl.quantity, lvl.orders); });
+    }
+
+    // Every resting order, laid out like depth(): onLevel(is_sell_side, price, quantity, orders) for each level, then
+    // onOrder(order_id, quantity) for each of its orders in time priority
+    template<typename L, typename O>
+    void forEachResting(L&& onLevel, O&& onOrder) {
+        auto walk = [&](bool is_sell_side, uint32_t price, const PriceLevel& lvl) {
+            onLevel(is_sell_side, price, lvl.quantity, lvl.orders);
+            for (OrderHandle h = lvl.head; h != NullOrder; h = orderPool[h].next)
+                onOrder(orderPool[h].order_id, orderPool[h].quantity);
+        };
+        buyMap.forBest(SIZE_MAX, [&](uint32_t price, const PriceLevel& lvl) { walk(false, price, lvl); });
+        sellMap.forBest(SIZE_MAX, [&](uint32_t price, const PriceLevel& lvl) { walk(true, price, lvl); });
+    }
+
+private:
+    template<bool IsBuy>
+    void add(uint32_t id, uint32_t price, uint32_t count, int64_t ts);
+    // Fills an incoming order against the opposite side as far as price allows, returns what's left of count
+    template<bool IsBuy>
+    uint32_t match(uint32_t id, uint32_t price, uint32_t count, int64_t ts);
+    template<bool IsBuy>
+    void amendOn(OrderHandle h, uint32_t price, uint32_t count, int64_t ts);
+
+    template<bool IsBuy>
+    BookSide<IsBuy>& side() {
+        if constexpr (IsBuy)
+            return buyMap;
+        else
+            return sellMap;
+    }
+
+    // Kept once here instead of on every order, a book only ever sees one instrument
+    std::string symbol;
+    Sink& sink;
+
+    // Every resting order lives in the pool, the price levels and the index only hold 32 bit handles into it
+    OrderPool orderPool;
+    // Best bid / best ask first. Dense ladders when the instrument has a configured tick range, trees otherwise
+    BookSide<true>  buyMap;
+    BookSide<false> sellMap;
+
+    // Map order_id -> handle of the live order, used by cancels to unlink in O(1)
+    OrderIndex orderMap;
+};
+
+template<typename Sink>
+template<bool IsBuy>
+uint32_t OrderBook<Sink>::match(uint32_t id, uint32_t price, uint32_t count, int64_t ts) {
+    BookSide<!IsBuy>& opposite = side<!IsBuy>();
+    auto crosses = [price](uint32_t best) { return IsBuy ? best <= price : best >= price; };
+
+    uint32_t remaining = count;
+    while (remaining > 0 && !opposite.empty() && crosses(opposite.bestPrice())) {
+        uint32_t levelPrice = opposite.bestPrice();
+        PriceLevel& level = opposite.bestLevel();
+        while (remaining && !level.empty()) {
+            OrderHandle h = level.head;
+            Order& top = orderPool[h];
+            uint32_t m = std::min(remaining, top.quantity);
+            remaining      -= m;
+            top.quantity   -= m;
+            level.quantity -= m;
+            sink.OrderExecuted(top.order_id, id, id, top.price, m, ts);
+            if (top.quantity == 0) {
+                orderMap.erase(top.order_id, h);
+                sink.OrderRemoved(top.order_id);
+                orderPool.unlink(level, h);
+                orderPool.release(h);
+            }
+        }
+        sink.LevelChanged(/*is_sell_side=*/IsBuy, levelPrice, level.quantity, level.orders, ts);
+        if (level.empty())
+            opposite.popBest();
+    }
+    return remaining;
+}
+
+template<typename Sink>
+template<bool IsBuy>
+void OrderBook<Sink>::add(uint32_t id, uint32_t price, uint32_t count, int64_t ts) {
+    // The incoming order only needs a pool node if some of it ends up resting,
+    // so match straight off the arguments and allocate afterwards
+    uint32_t remaining = match<IsBuy>(id, price, count, ts);
+    if (remaining == 0) {
+        // Never rested, so nothing left for a cancel to find
+        sink.OrderRemoved(id);
+        return;
+    }
+    OrderHandle h = orderPool.allocate();
+    Order& order = orderPool[h];
+    order.order_id = id;
+    order.price    = price;
+    order.quantity = remaining;
+    PriceLevel& level = side<IsBuy>().level(price); // creates the level if missing
+    orderPool.pushBack(level, h);
+    orderMap.insert(id, h);
+    sink.OrderAdded(id, symbol.c_str(), price, remaining, /*is_sell_side=*/!IsBuy, ts);
+    sink.LevelChanged(/*is_sell_side=*/!IsBuy, price, level.quantity, level.orders, ts);
+}
+
+template<typename Sink>
+void OrderBook<Sink>::cancel(uint32_t id, int64_t ts) {
+    bool ok = false;
+    OrderHandle h = orderMap.find(id);
+    if (h != NullOrder) {
+        const Order& order = orderPool[h];
+        // Orders don't store their side: bids are all at or below the best bid and asks all above it
+        bool isBuy = !buyMap.empty() && order.price <= buyMap.bestPrice();
+        auto unlinkFrom = [&](auto& bookSide) {
+            PriceLevel* lvl = bookSide.find(order.price);
+            if (!lvl)
+                return false;
+            orderPool.unlink(*lvl, h);      // O(1) unlink through the intrusive links
+            sink.LevelChanged(!isBuy, order.price, lvl->quantity, lvl->orders, ts);
+            if (lvl->empty())
+                bookSide.erase(order.price); // drop empty price level
+            return true;
+        };
+        ok = isBuy ? unlinkFrom(buyMap) : unlinkFrom(sellMap);
+
+        // Always remove from the index to avoid dangling handles / double-cancels
+        orderMap.erase(id);
+        sink.OrderRemoved(id);
+        orderPool.release(h);
+    }
+    sink.OrderDeleted(id, ok, ts);
+}
+
+template<typename Sink>
+void OrderBook<Sink>::amend(uint32_t id, uint32_t price, uint32_t count, int64_t ts) {
+    OrderHandle h = orderMap.find(id);
+    if (h == NullOrder) {
+        sink.OrderAmended(id, false, price, count, ts);
+        return;
+    }
+    // Same side rule as cancel, decided before the order leaves its level
+    if (!buyMap.empty() && orderPool[h].price <= buyMap.bestPrice())
+        amendOn<true>(h, price, count, ts);
+    else
+        amendOn<false>(h, price, count, ts);
+}
+
+template<typename Sink>
+template<bool IsBuy>
+void OrderBook<Sink>::amendOn(OrderHandle h, uint32_t price, uint32_t count, int64_t ts) {
+    BookSide<IsBuy>& own = side<IsBuy>();
+    Order& order = orderPool[h];
+    uint32_t id = order.order_id;
+    uint32_t oldPrice = order.price;
+    PriceLevel* level = own.find(oldPrice);
+
+    if (price == oldPrice && count != 0 && count <= order.quantity) {
+        // Smaller (or the same) at the same price: changed in place, it keeps its place in the level
+        level->quantity -= order.quantity - count;
+        order.quantity = count;
+        sink.LevelChanged(/*is_sell_side=*/!IsBuy, price, level->quantity, level->orders, ts);
+        sink.OrderAmended(id, true, price, count, ts);
+        return;
+    }
+
+    // Anything else loses time priority: out of its level, matched at the new price like a new order, and whatever is
+    // left goes to the back of the new level. The node (and its index entry) is kept for that
+    orderPool.unlink(*level, h);
+    if (price != oldPrice || count == 0) {
+        sink.LevelChanged(/*is_sell_side=*/!IsBuy, oldPrice, level->quantity, level->orders, ts);
+        if (level->empty())
+            own.erase(oldPrice);
+    }
+    uint32_t remaining = count ? match<IsBuy>(id, price, count, ts) : 0;
+    if (remaining == 0) {
+        orderMap.erase(id, h);
+        sink.OrderRemoved(id);
+        orderPool.release(h);
+    } else {
+        order.price = price;
+        order.quantity = remaining;
+        PriceLevel& to = own.level(price);
+        orderPool.pushBack(to, h);
+        sink.LevelChanged(/*is_sell_side=*/!IsBuy, price, to.quantity, to.orders, ts);
+    }
+    sink.OrderAmended(id, true, price, remaining, ts);
+}
@@ -0,0 +1,123 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "OrderPool.hpp"
+
+// order_id -> OrderHandle, open addressing with linear probing.
+// Replaces the unordered_map whose per-entry node allocation showed up on every add.
+// Erase uses backward shift deletion so there are no tombstones and probe chains stay short
+// no matter how many orders have come and gone; the table only reallocates when the number of
+// live orders reaches a new high.
+class OrderIndex {
+public:
+    explicit OrderIndex(size_t initialCapacity = 1024) {
+        size_t cap = 16;
+        while (cap < initialCapacity * 2)
+            cap <<= 1;
+        slots.assign(cap, Slot{});
+        mask = cap - 1;
+    }
+
+    size_t size() const { return count; }
+
+    OrderHandle find(uint32_t id) const {
+        for (size_t i = home(id); ; i = (i + 1) & mask) {
+            const Slot& s = slots[i];
+            if (s.handle == NullOrder)
+                return NullOrder;
+            if (s.id == id)
+                return s.handle;
+        }
+    }
+
+    // Inserts or overwrites (a reused order id points at the newest order, same as orderMap[id] = ...)
+    void insert(uint32_t id, OrderHandle h) {
+        if ((count + 1) * 2 > slots.size())
+            rehash(slots.size() * 2);
+        for (size_t i = home(id); ; i = (i + 1) & mask) {
+            Slot& s = slots[i];
+            if (s.handle == NullOrder) {
+                s = Slot{id, h};
+                ++count;
+                return;
+            }
+            if (s.id == id) {
+                s.handle = h;
+                return;
+            }
+        }
+    }
+
+    // Removes id only if it still maps to h, so a filled order cannot drop the entry of a newer order reusing its id
+    bool erase(uint32_t id, OrderHandle h) {
+        size_t i = home(id);
+        for (; ; i = (i + 1) & mask) {
+            const Slot& s = slots[i];
+            if (s.handle == NullOrder)
+                return false;
+            if (s.id == id)
+                break;
+        }
+        if (slots[i].handle != h)
+            return false;
+        eraseSlot(i);
+        return true;
+    }
+
+    bool erase(uint32_t id) {
+        for (size_t i = home(id); ; i = (i + 1) & mask) {
+            const Slot& s = slots[i];
+            if (s.handle == NullOrder)
+                return false;
+            if (s.id == id) {
+                eraseSlot(i);
+                return true;
+            }
+        }
+    }
+
+private:
+    struct Slot {
+        uint32_t    id = 0;
+        OrderHandle handle = NullOrder; // NullOrder marks an empty slot
+    };
+
+    size_t home(uint32_t id) const {
+        // Fibonacci hashing, order ids are often sequential so spread them over the table
+        return static_cast<size_t>((id * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+    }
+
+    void eraseSlot(size_t hole) {
+        // Backward shift: pull later entries of the probe chain into the hole when that doesn't move them before their home slot
+        for (size_t j = (hole + 1) & mask; slots[j].handle != NullOrder; j = (j + 1) & mask) {
+            size_t h = home(slots[j].id);
+            bool movable = (hole <= j) ? (h <= hole || h > j) : (h <= hole && h > j);
+            if (movable) {
+                slots[hole] = slots[j];
+                hole = j;
+            }
+        }
+        slots[hole] = Slot{};
+        --count;
+    }
+
+    void rehash(size_t newCapacity) {
+        std::vector<Slot> old;
+        old.swap(slots);
+        slots.assign(newCapacity, Slot{});
+        mask = newCapacity - 1;
+        for (const Slot& s : old) {
+            if (s.handle == NullOrder)
+                continue;
+            size_t i = home(s.id);
+            while (slots[i].handle != NullOrder)
+                i = (i + 1) & mask;
+            slots[i] = s;
+        }
+    }
+
+    std::vector<Slot> slots;
+    size_t mask = 0;
+    size_t count = 0;
+};
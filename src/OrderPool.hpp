@@ -0,0 +1,109 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+// Orders are referred to by 32 bit handles into a per-instrument slab instead of shared_ptrs.
+// A handle stays valid until it is released back to the pool, and the pool never moves nodes around,
+// so a handle can be kept in both the price level list and the order index without any refcounting.
+using OrderHandle = uint32_t;
+constexpr OrderHandle NullOrder = UINT32_MAX;
+
+// Five words and nothing else, the pool is most of a deep book's memory. There's no side: an order is on the buy side
+// exactly when its price is at or below the best bid, since a resting book never crosses
+struct Order {
+    uint32_t    order_id;
+    uint32_t    price;
+    uint32_t    quantity;
+    // Intrusive links to the neighbours in the same price level (time priority order)
+    OrderHandle prev;
+    OrderHandle next;
+};
+static_assert(sizeof(Order) == 20, "Order is meant to stay at 20 bytes");
+static_assert(std::is_trivially_copyable<Order>::value, "orders are copied around as plain memory");
+
+// Head and tail of the FIFO of orders resting at one price, plus the level's totals for market data.
+// pushBack / unlink keep both totals up to date, a partial fill has to take its quantity off by hand
+struct PriceLevel {
+    OrderHandle head = NullOrder;
+    OrderHandle tail = NullOrder;
+    uint32_t    orders = 0;
+    uint64_t    quantity = 0;
+
+    bool empty() const { return head == NullOrder; }
+};
+
+class OrderPool {
+public:
+    OrderPool() = default;
+    OrderPool(const OrderPool&) = delete;
+    OrderPool& operator=(const OrderPool&) = delete;
+
+    Order& operator[](OrderHandle h) { return chunks[h >> ChunkBits][h & ChunkMask]; }
+    const Order& operator[](OrderHandle h) const { return chunks[h >> ChunkBits][h & ChunkMask]; }
+
+    // Hands out a node, recycled from the free list when possible.
+    // Only grows (one chunk at a time) when every node ever handed out is still live,
+    // so in steady state adds and cancels never touch the allocator.
+    OrderHandle allocate() {
+        if (freeHead == NullOrder)
+            grow();
+        OrderHandle h = freeHead;
+        freeHead = (*this)[h].next;
+        return h;
+    }
+
+    void release(OrderHandle h) {
+        (*this)[h].next = freeHead;
+        freeHead = h;
+    }
+
+    // Appends to the back of the level, i.e. lowest time priority
+    void pushBack(PriceLevel& level, OrderHandle h) {
+        Order& o = (*this)[h];
+        o.prev = level.tail;
+        o.next = NullOrder;
+        if (level.tail != NullOrder)
+            (*this)[level.tail].next = h;
+        else
+            level.head = h;
+        level.tail = h;
+        ++level.orders;
+        level.quantity += o.quantity;
+    }
+
+    // O(1) removal from anywhere in the level, the node itself is not released
+    void unlink(PriceLevel& level, OrderHandle h) {
+        Order& o = (*this)[h];
+        if (o.prev != NullOrder)
+            (*this)[o.prev].next = o.next;
+        else
+            level.head = o.next;
+        if (o.next != NullOrder)
+            (*this)[o.next].prev = o.prev;
+        else
+            level.tail = o.prev;
+        --level.orders;
+        level.quantity -= o.quantity;
+    }
+
+private:
+    static constexpr uint32_t ChunkBits = 12;
+    static constexpr uint32_t ChunkSize = 1u << ChunkBits;
+    static constexpr uint32_t ChunkMask = ChunkSize - 1;
+
+    void grow() {
+        // Chunks are never reallocated, so references to live nodes stay valid across a grow
+        auto chunk = std::make_unique<Order[]>(ChunkSize);
+        OrderHandle base = static_cast<OrderHandle>(chunks.size()) << ChunkBits;
+        // Thread the new nodes onto the free list in ascending order so handles are handed out sequentially
+        for (uint32_t i = 0; i < ChunkSize; ++i)
+            chunk[i].next = (i + 1 < ChunkSize) ? base + i + 1 : freeHead;
+        chunks.push_back(std::move(chunk));
+        freeHead = base;
+    }
+
+    std::vector<std::unique_ptr<Order[]>> chunks;
+    OrderHandle freeHead = NullOrder;
+};
@@ -0,0 +1,181 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "CpuRelax.hpp"
+
+class InstrumentWorker;
+
+// Engine wide order_id -> InstrumentWorker index so a cancel ("C <id>", no instrument) reaches the book holding the order.
+//
+// Connection threads insert on every add and look up on every cancel, workers erase on fill / cancel.
+// Lookups never block: the index is split into shards, each a small open-addressing table guarded by a sequence
+// counter (seqlock). Readers just probe and retry if a writer touched the shard meanwhile. Writers of the same shard
+// serialize on a per-shard spin flag, which is only ever held for a handful of stores.
+class OrderRouter {
+public:
+    OrderRouter() {
+        for (auto& shard : shards)
+            shard.install(std::make_unique<Table>(InitialShardCapacity));
+    }
+    OrderRouter(const OrderRouter&) = delete;
+    OrderRouter& operator=(const OrderRouter&) = delete;
+
+    InstrumentWorker* find(uint32_t id) const {
+        const Shard& shard = shardFor(id);
+        for (;;) {
+            uint32_t before = shard.seq.load(std::memory_order_acquire);
+            if (before & 1) {
+                // writer in progress
+                cpuRelax();
+                continue;
+            }
+            const Table* t = shard.table.load(std::memory_order_acquire);
+            InstrumentWorker* found = nullptr;
+            for (size_t i = home(id, t->mask); ; i = (i + 1) & t->mask) {
+                uint64_t key = t->slots[i].key.load(std::memory_order_relaxed);
+                if (key == EmptyKey)
+                    break;
+                if (key == keyOf(id)) {
+                    found = t->slots[i].worker.load(std::memory_order_relaxed);
+                    break;
+                }
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (shard.seq.load(std::memory_order_relaxed) == before)
+                return found;
+        }
+    }
+
+    // Inserts or overwrites, a reused id routes to the most recent order's worker
+    void insert(uint32_t id, InstrumentWorker* worker) {
+        Shard& shard = shardFor(id);
+        WriteGuard guard(shard);
+        Table* t = shard.table.load(std::memory_order_relaxed);
+        if ((shard.count + 1) * 2 > t->mask + 1)
+            t = shard.grow();
+        for (size_t i = home(id, t->mask); ; i = (i + 1) & t->mask) {
+            Slot& s = t->slots[i];
+            uint64_t key = s.key.load(std::memory_order_relaxed);
+            if (key == EmptyKey) {
+                s.worker.store(worker, std::memory_order_relaxed);
+                s.key.store(keyOf(id), std::memory_order_relaxed);
+                ++shard.count;
+                return;
+            }
+            if (key == keyOf(id)) {
+                s.worker.store(worker, std::memory_order_relaxed);
+                return;
+            }
+        }
+    }
+
+    // Removes id if it still routes to worker (a newer order reusing the id elsewhere keeps its entry)
+    void erase(uint32_t id, const InstrumentWorker* worker) {
+        Shard& shard = shardFor(id);
+        WriteGuard guard(shard);
+        Table* t = shard.table.load(std::memory_order_relaxed);
+        size_t i = home(id, t->mask);
+        for (; ; i = (i + 1) & t->mask) {
+            uint64_t key = t->slots[i].key.load(std::memory_order_relaxed);
+            if (key == EmptyKey)
+                return;
+            if (key == keyOf(id))
+                break;
+        }
+        if (t->slots[i].worker.load(std::memory_order_relaxed) != worker)
+            return;
+        // Backward shift deletion so the table never fills up with tombstones over a trading day
+        size_t hole = i;
+        for (size_t j = (hole + 1) & t->mask; ; j = (j + 1) & t->mask) {
+            uint64_t key = t->slots[j].key.load(std::memory_order_relaxed);
+            if (key == EmptyKey)
+                break;
+            size_t h = home(static_cast<uint32_t>(key - 1), t->mask);
+            bool movable = (hole <= j) ? (h <= hole || h > j) : (h <= hole && h > j);
+            if (movable) {
+                t->slots[hole].worker.store(t->slots[j].worker.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                t->slots[hole].key.store(key, std::memory_order_relaxed);
+                hole = j;
+            }
+        }
+        t->slots[hole].key.store(EmptyKey, std::memory_order_relaxed);
+        t->slots[hole].worker.store(nullptr, std::memory_order_relaxed);
+        --shard.count;
+    }
+
+private:
+    static constexpr size_t ShardBits = 6;
+    static constexpr size_t InitialShardCapacity = 1024;
+    // Keys are stored as id + 1 so that 0 can mean empty and every uint32_t id is still representable
+    static constexpr uint64_t EmptyKey = 0;
+    static uint64_t keyOf(uint32_t id) { return uint64_t(id) + 1; }
+
+    static uint64_t mix(uint32_t id) { return id * 0x9E3779B97F4A7C15ull; }
+    static size_t home(uint32_t id, size_t mask) { return static_cast<size_t>(mix(id) >> 32) & mask; }
+
+    struct Slot {
+        std::atomic<uint64_t> key{EmptyKey};
+        std::atomic<InstrumentWorker*> worker{nullptr};
+    };
+
+    struct Table {
+        explicit Table(size_t capacity) : mask(capacity - 1), slots(std::make_unique<Slot[]>(capacity)) { }
+        size_t mask;
+        std::unique_ptr<Slot[]> slots;
+    };
+
+    struct alignas(64) Shard {
+        std::atomic<uint32_t> seq{0};
+        std::atomic<bool> locked{false};
+        std::atomic<Table*> table{nullptr};
+        size_t count = 0;
+        // Every table this shard has used. A reader may still be probing an old one after a grow,
+        // so they are only freed with the router
+        std::vector<std::unique_ptr<Table>> tables;
+
+        void install(std::unique_ptr<Table> t) {
+            table.store(t.get(), std::memory_order_release);
+            tables.push_back(std::move(t));
+        }
+
+        Table* grow() {
+            const Table* old = table.load(std::memory_order_relaxed);
+            auto bigger = std::make_unique<Table>((old->mask + 1) * 2);
+            for (size_t i = 0; i <= old->mask; ++i) {
+                uint64_t key = old->slots[i].key.load(std::memory_order_relaxed);
+                if (key == EmptyKey)
+                    continue;
+                size_t j = home(static_cast<uint32_t>(key - 1), bigger->mask);
+                while (bigger->slots[j].key.load(std::memory_order_relaxed) != EmptyKey)
+                    j = (j + 1) & bigger->mask;
+                bigger->slots[j].worker.store(old->slots[i].worker.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                bigger->slots[j].key.store(key, std::memory_order_relaxed);
+            }
+            install(std::move(bigger));
+            return table.load(std::memory_order_relaxed);
+        }
+    };
+
+    // Takes the shard's writer flag and makes the sequence odd for the duration of the write
+    struct WriteGuard {
+        explicit WriteGuard(Shard& s) : shard(s) {
+            while (shard.locked.exchange(true, std::memory_order_acquire))
+                cpuRelax();
+            shard.seq.store(shard.seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+        ~WriteGuard() {
+            shard.seq.store(shard.seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+            shard.locked.store(false, std::memory_order_release);
+        }
+        Shard& shard;
+    };
+
+    Shard& shardFor(uint32_t id) { return shards[mix(id) >> (64 - ShardBits)]; }
+    const Shard& shardFor(uint32_t id) const { return shards[mix(id) >> (64 - ShardBits)]; }
+
+    Shard shards[size_t(1) << ShardBits];
+};
@@ -0,0 +1,246 @@
+#include "OutputPublisher.hpp"
+
+#include <cerrno>
+#include <charconv>
+#include <climits>
+#include <cstdio>
+
+#include <unistd.h>
+
+#include "Affinity.hpp"
+#include "engine.hpp"
+
+namespace {
+
+// writev until everything is out, picking up after partial writes
+void writevAll(int fd, struct iovec* iov, int count) {
+    while (count > 0) {
+        ssize_t n = writev(fd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("[SERVER] output writev");
+            return;
+        }
+        while (count > 0 && static_cast<size_t>(n) >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+// Flush a batch once this much text has been formatted / this many iovecs collected
+constexpr size_t TextFlushBytes = 64 * 1024;
+// Most one formatText() line takes
+constexpr size_t MaxTextLine = 128;
+constexpr size_t MaxIov = IOV_MAX < 1024 ? IOV_MAX : 1024;
+
+} // namespace
+
+OutputPublisher::OutputPublisher(Format format, int fd)
+    : format(format), fd(fd) {
+    if (format == Format::Text)
+        text = std::make_unique<char[]>(TextFlushBytes);
+    iov.reserve(MaxIov);
+}
+
+void OutputPublisher::start(int cpu) {
+    publisherThread = std::thread([this, cpu]() {
+        if (!pinThisThread(cpu))
+            SyncCerr() << "[SERVER] could not pin the output publisher to cpu " << cpu << std::endl;
+        run();
+    });
+}
+
+void OutputPublisher::stopAndJoin() {
+    stop = true;
+    bell.ring();
+    if (publisherThread.joinable()) {
+        if (publisherThread.get_id() == std::this_thread::get_id())
+            // exit() called from the publisher thread itself, nothing more to drain from here
+            publisherThread.detach();
+        else
+            publisherThread.join();
+    }
+}
+
+OutputRing& OutputPublisher::createRing(LatencyHistogram* publishLatency) {
+    std::lock_guard<std::mutex> lock(ringsMutex);
+    rings.push_back(std::make_unique<OutputRing>(bell, publishLatency));
+    ringsVersion.fetch_add(1, std::memory_order_release);
+    return *rings.back();
+}
+
+void OutputPublisher::refreshRings() {
+    // Only takes the mutex when a ring has been added since the last pass
+    if (ringsVersion.load(std::memory_order_acquire) == seenVersion)
+        return;
+    std::lock_guard<std::mutex> lock(ringsMutex);
+    seenVersion = ringsVersion.load(std::memory_order_relaxed);
+    activeRings.clear();
+    for (auto& r : rings)
+        activeRings.push_back(r.get());
+}
+
+bool OutputPublisher::pending() {
+    refreshRings();
+    size_t from;
+    for (OutputRing* r : activeRings)
+        if (r->readable(from))
+            return true;
+    return !shared.empty();
+}
+
+void OutputPublisher::run() {
+    unsigned idle = 0;
+    while (true) {
+        if (drainOnce()) {
+            idle = 0;
+            continue;
+        }
+        if (stop) {
+            // Workers may still have been publishing when stop was set, one more pass picks that up
+            drainOnce();
+            return;
+        }
+        if (++idle < 256) {
+            cpuRelax();
+            continue;
+        }
+        bell.sleepUnless([this] { return stop || pending(); });
+    }
+}
+
+size_t OutputPublisher::formatText(const OutputEvent& e, char* buf) {
+    char* p = buf;
+    auto num = [&p](auto v) { p = std::to_chars(p, p + 24, v).ptr; *p++ = ' '; };
+    switch (e.type) {
+        case 'B':
+        case 'S': {
+            *p++ = e.type;
+            *p++ = ' ';
+            num(e.id);
+            size_t len = strnlen(e.symbol, sizeof(e.symbol));
+            memcpy(p, e.symbol, len);
+            p += len;
+            *p++ = ' ';
+            num(e.price);
+            num(e.count);
+            break;
+        }
+        case 'E':
+            *p++ = 'E';
+            *p++ = ' ';
+            num(e.id);
+            num(e.new_id);
+            num(e.execution_id);
+            num(e.price);
+            num(e.count);
+            break;
+        case 'X':
+        case 'R':
+            *p++ = e.type;
+            *p++ = ' ';
+            num(e.id);
+            *p++ = e.flag;
+            *p++ = ' ';
+            break;
+        case 'M':
+            *p++ = 'M';
+            *p++ = ' ';
+            num(e.id);
+            *p++ = e.flag;
+            *p++ = ' ';
+            num(e.price);
+            num(e.count);
+            break;
+        default:
+            return 0;
+    }
+    p = std::to_chars(p, p + 24, e.timestamp).ptr;
+    *p++ = '\n';
+    return p - buf;
+}
+
+void OutputPublisher::flush() {
+    if (textUsed != 0)
+        iov.push_back({text.get(), textUsed});
+    if (!iov.empty())
+        writevAll(fd, iov.data(), static_cast<int>(iov.size()));
+    recordPublishLatency();
+    // Only now hand the slots back, binary iovecs point straight into the rings
+    for (const Drained& d : drained)
+        d.ring->consumed(d.upTo);
+    drained.clear();
+    iov.clear();
+    textUsed = 0;
+}
+
+void OutputPublisher::recordPublishLatency() {
+    int64_t now = 0;
+    for (const Drained& d : drained) {
+        LatencyHistogram* h = d.ring->publishLatency;
+        if (!h)
+            continue;
+        if (now == 0)
+            now = getCurrentTimestamp();
+        for (size_t i = d.from; i != d.upTo; ++i)
+            h->record(LatencyStats::delta(d.ring->events[i & d.ring->mask].timestamp, now));
+    }
+}
+
+bool OutputPublisher::drainOnce() {
+    refreshRings();
+    bool any = false;
+
+    auto add = [this](const OutputEvent* events, size_t n) {
+        if (format == Format::Binary) {
+            iov.push_back({const_cast<OutputEvent*>(events), n * sizeof(OutputEvent)});
+            return;
+        }
+        // Straight into the buffer, written out as soon as another line might not fit, however long the run is
+        for (size_t i = 0; i < n; ++i) {
+            if (textUsed + MaxTextLine > TextFlushBytes)
+                flush();
+            textUsed += formatText(events[i], text.get() + textUsed);
+        }
+    };
+    // Binary runs are an iovec each, at most a few per ring
+    auto full = [this]() { return iov.size() + 3 > MaxIov; };
+
+    // The shared lane is taken first but written after the rings: whatever a shard had published by the time one of
+    // these events was pushed goes out before it, so an "X <id> R" for an order a fill just took off the book doesn't
+    // overtake the fill's E
+    sharedBatch.clear();
+    OutputEvent e;
+    while (shared.try_pop(e))
+        sharedBatch.push_back(e);
+
+    for (OutputRing* r : activeRings) {
+        size_t from;
+        size_t n = r->readable(from);
+        if (n == 0)
+            continue;
+        any = true;
+        size_t cap = r->mask + 1;
+        size_t first = std::min(n, cap - (from & r->mask));
+        // Up to two contiguous runs, the second one starting over at the beginning of the ring
+        add(&r->events[from & r->mask], first);
+        if (first < n)
+            add(&r->events[0], n - first);
+        drained.push_back({r, from, from + n});
+        if (full())
+            flush();
+    }
+    if (!sharedBatch.empty()) {
+        add(sharedBatch.data(), sharedBatch.size());
+        any = true;
+    }
+    flush();
+    return any;
+}
@@ -0,0 +1,308 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <sys/uio.h>
+
+#include "CpuRelax.hpp"
+#include "Doorbell.hpp"
+#include "MpscRing.hpp"
+#include "LatencyStats.hpp"
+
+// Fixed size binary record of one engine output event. This is also the on-the-wire layout of --output=binary
+// (native little-endian, 40 bytes per record, no framing).
+struct OutputEvent {
+    char     type;          // 'B' / 'S' order added, 'E' executed, 'X' deleted, 'M' amended, 'R' refused (engine
+                            // overloaded, or the book's journal failed)
+    char     flag;          // 'X' / 'M': 'A' accepted, 'R' rejected. 'R': the refused command, 'B', 'S', 'C' or 'M'
+    uint16_t reserved;
+    uint32_t id;            // order id, resting order id for 'E'
+    uint32_t new_id;        // 'E': incoming order id
+    uint32_t execution_id;  // 'E'
+    uint32_t price;
+    uint32_t count;         // 'M': what rests at price after the amend (0: none), or the count asked for when rejected
+    char     symbol[8];     // 'B' / 'S', NUL padded (not terminated when all 8 chars are used)
+    int64_t  timestamp;
+
+    static OutputEvent added(uint32_t id, const char* symbol, uint32_t price, uint32_t count, bool is_sell_side, int64_t ts) {
+        OutputEvent e{};
+        e.type = is_sell_side ? 'S' : 'B';
+        e.id = id;
+        e.price = price;
+        e.count = count;
+        memcpy(e.symbol, symbol, strnlen(symbol, sizeof(e.symbol)));
+        e.timestamp = ts;
+        return e;
+    }
+
+    static OutputEvent executed(uint32_t resting_id, uint32_t new_id, uint32_t execution_id,
+                                uint32_t price, uint32_t count, int64_t ts) {
+        OutputEvent e{};
+        e.type = 'E';
+        e.id = resting_id;
+        e.new_id = new_id;
+        e.execution_id = execution_id;
+        e.price = price;
+        e.count = count;
+        e.timestamp = ts;
+        return e;
+    }
+
+    static OutputEvent deleted(uint32_t id, bool cancel_accepted, int64_t ts) {
+        OutputEvent e{};
+        e.type = 'X';
+        e.flag = cancel_accepted ? 'A' : 'R';
+        e.id = id;
+        e.timestamp = ts;
+        return e;
+    }
+
+    static OutputEvent amended(uint32_t id, bool accepted, uint32_t price, uint32_t count, int64_t ts) {
+        OutputEvent e{};
+        e.type = 'M';
+        e.flag = accepted ? 'A' : 'R';
+        e.id = id;
+        e.price = price;
+        e.count = count;
+        e.timestamp = ts;
+        return e;
+    }
+
+    static OutputEvent refused(uint32_t id, char command, int64_t ts) {
+        OutputEvent e{};
+        e.type = 'R';
+        e.flag = command;
+        e.id = id;
+        e.timestamp = ts;
+        return e;
+    }
+};
+static_assert(sizeof(OutputEvent) == 40, "OutputEvent is a wire format");
+
+// Single producer / single consumer ring of OutputEvents. Each matching shard owns one, shared by the books of all its
+// instruments, and writes into it without any locking from the shard thread; the publisher thread is the only reader.
+class OutputRing {
+public:
+    explicit OutputRing(Doorbell& publisherBell, LatencyHistogram* publishLatency = nullptr, size_t capacity = 8192)
+        : bell(publisherBell), publishLatency(publishLatency) {
+        size_t cap = 2;
+        while (cap < capacity)
+            cap <<= 1;
+        mask = cap - 1;
+        events = std::make_unique<OutputEvent[]>(cap);
+    }
+    OutputRing(const OutputRing&) = delete;
+    OutputRing& operator=(const OutputRing&) = delete;
+
+    // Same calls as the old static Output class, but from the owning shard's thread only
+    void OrderAdded(uint32_t id, const char* symbol, uint32_t price, uint32_t count, bool is_sell_side, int64_t output_timestamp) {
+        push(OutputEvent::added(id, symbol, price, count, is_sell_side, output_timestamp));
+    }
+    void OrderExecuted(uint32_t resting_id, uint32_t new_id, uint32_t execution_id,
+                       uint32_t price, uint32_t count, int64_t output_timestamp) {
+        push(OutputEvent::executed(resting_id, new_id, execution_id, price, count, output_timestamp));
+    }
+    void OrderDeleted(uint32_t id, bool cancel_accepted, int64_t output_timestamp) {
+        push(OutputEvent::deleted(id, cancel_accepted, output_timestamp));
+    }
+    void OrderAmended(uint32_t id, bool accepted, uint32_t price, uint32_t count, int64_t output_timestamp) {
+        push(OutputEvent::amended(id, accepted, price, count, output_timestamp));
+    }
+    void OrderRefused(uint32_t id, char command, int64_t output_timestamp) {
+        push(OutputEvent::refused(id, command, output_timestamp));
+    }
+
+    void push(const OutputEvent& e) {
+        size_t t = written;
+        // Full: the publisher is behind, wait for it rather than drop events
+        // (handing it whatever this batch has written so far first, or it would be waiting for us)
+        while (t - cachedHead > mask) {
+            publish();
+            cachedHead = head.load(std::memory_order_acquire);
+            if (t - cachedHead <= mask)
+                break;
+            if (discarding.load(std::memory_order_acquire))
+                return;
+            cpuRelax();
+        }
+        events[t & mask] = e;
+        written = t + 1;
+        if (!batching)
+            publish();
+    }
+
+    // Between the two, pushed events are only handed to the publisher at endBatch(): one release store and one
+    // doorbell check for the whole batch instead of one per event
+    void beginBatch() { batching = true; }
+    void endBatch() {
+        batching = false;
+        publish();
+    }
+
+    // Setup, before anything is pushed. Events are only written out once the journal records of the commands behind
+    // them are on disk: every publish() notes how many records its producer had appended by then (journalAppended),
+    // and the publisher holds those events back until journalDurable has caught up with that. The journal rings
+    // publisherBell() whenever journalDurable moves
+    void holdUntilJournaled(const std::atomic<size_t>& journalAppended, const std::atomic<size_t>& journalDurable) {
+        appended = &journalAppended;
+        durable = &journalDurable;
+        marks = std::make_unique<Mark[]>(MarkCapacity);
+    }
+    Doorbell& publisherBell() { return bell; }
+    // Any thread: the held events will never be let go (the journal lost a record they depend on). The producer
+    // stops waiting for room that won't come and drops what doesn't fit from then on
+    void discardHeld() { discarding.store(true, std::memory_order_release); }
+
+private:
+    friend class OutputPublisher;
+
+    void publish() {
+        if (written == tail.load(std::memory_order_relaxed))
+            return;
+        if (appended) {
+            // Out of marks: the publisher is waiting on the disk, and so does this batch
+            size_t m = markTail.load(std::memory_order_relaxed);
+            while (m - cachedMarkHead >= MarkCapacity) {
+                cachedMarkHead = markHead.load(std::memory_order_acquire);
+                if (m - cachedMarkHead < MarkCapacity)
+                    break;
+                if (discarding.load(std::memory_order_acquire))
+                    break;
+                cpuRelax();
+            }
+            // Without a mark (only once discarding) the batch just never goes out
+            if (m - cachedMarkHead < MarkCapacity) {
+                marks[m % MarkCapacity] = Mark{written, appended->load(std::memory_order_relaxed)};
+                markTail.store(m + 1, std::memory_order_release);
+            }
+        }
+        tail.store(written, std::memory_order_release);
+        bell.ring();
+    }
+
+    // Publisher side: the published but not yet written events are [head, tail), or only up to the last mark the
+    // journal has caught up with
+    size_t readable(size_t& from) {
+        from = head.load(std::memory_order_relaxed);
+        return (durable ? journaled() : tail.load(std::memory_order_acquire)) - from;
+    }
+    void consumed(size_t upTo) { head.store(upTo, std::memory_order_release); }
+
+    size_t journaled() {
+        size_t onDisk = durable->load(std::memory_order_acquire);
+        size_t m = markHead.load(std::memory_order_relaxed);
+        size_t t = markTail.load(std::memory_order_acquire);
+        for (; m != t && marks[m % MarkCapacity].records <= onDisk; ++m)
+            released = marks[m % MarkCapacity].events;
+        markHead.store(m, std::memory_order_release);
+        return released;
+    }
+
+    static constexpr size_t CacheLine = 64;
+    static constexpr size_t MarkCapacity = 1024;
+
+    // Events up to `events` may go once the journal has `records` of the producer's records
+    struct Mark {
+        size_t events;
+        size_t records;
+    };
+
+    Doorbell& bell;
+    // Event timestamp -> written out, recorded by the publisher
+    LatencyHistogram* const publishLatency;
+    std::unique_ptr<OutputEvent[]> events;
+    size_t mask = 0;
+    alignas(CacheLine) std::atomic<size_t> tail{0};
+    size_t cachedHead = 0;  // producer's last look at head, saves touching the publisher's line on every push
+    size_t written = 0;     // producer's own tail, ahead of tail while a batch is open
+    bool batching = false;
+    // Only with holdUntilJournaled()
+    const std::atomic<size_t>* appended = nullptr;
+    const std::atomic<size_t>* durable = nullptr;
+    std::unique_ptr<Mark[]> marks;
+    std::atomic<size_t> markTail{0};
+    size_t cachedMarkHead = 0;
+    std::atomic<bool> discarding{false};
+    alignas(CacheLine) std::atomic<size_t> head{0};
+    std::atomic<size_t> markHead{0};
+    size_t released = 0;    // publisher's: events the journal has caught up with
+};
+
+// Single thread that drains every shard's OutputRing in batches and writes them out with writev,
+// so output stops being a process wide lock taken (and flushed) once per event.
+class OutputPublisher {
+public:
+    enum class Format { Text, Binary };
+
+    explicit OutputPublisher(Format format = Format::Text, int fd = 1);
+    ~OutputPublisher() { stopAndJoin(); }
+    OutputPublisher(const OutputPublisher&) = delete;
+    OutputPublisher& operator=(const OutputPublisher&) = delete;
+
+    // cpu >= 0 pins the publisher thread to that core
+    void start(int cpu = -1);
+    // Writes out everything published so far, then stops the publisher thread
+    void stopAndJoin();
+
+    // A new ring for one producer thread, owned by the publisher.
+    // With publishLatency, the publisher records how long each of the ring's events waited to be written
+    OutputRing& createRing(LatencyHistogram* publishLatency = nullptr);
+
+    // For the rare events that don't come from a shard (e.g. cancels of unknown order ids rejected by a connection thread).
+    // Any thread may call these, they go through a shared multi producer lane. They're written after everything the
+    // shards had published when they were pushed, but a shard's batch still in the making (or, with a syncing journal,
+    // waiting for its group commit) can come out after them
+    void OrderDeleted(uint32_t id, bool cancel_accepted, int64_t output_timestamp) {
+        shared.push(OutputEvent::deleted(id, cancel_accepted, output_timestamp));
+        bell.ring();
+    }
+    void OrderAmended(uint32_t id, bool accepted, uint32_t price, uint32_t count, int64_t output_timestamp) {
+        shared.push(OutputEvent::amended(id, accepted, price, count, output_timestamp));
+        bell.ring();
+    }
+    // A command turned away at admission because its instrument's queue was full, see OverloadPolicy
+    void OrderRefused(uint32_t id, char command, int64_t output_timestamp) {
+        shared.push(OutputEvent::refused(id, command, output_timestamp));
+        bell.ring();
+    }
+
+    // Text rendering of one event, same lines the engine has always printed. buf needs 128 bytes
+    static size_t formatText(const OutputEvent& e, char* buf);
+
+private:
+    void run();
+    // One pass over every ring, returns whether anything was written
+    bool drainOnce();
+    bool pending();
+    void refreshRings();
+    void flush();
+    void recordPublishLatency();
+
+    Format format;
+    int fd;
+
+    std::thread publisherThread;
+    std::atomic<bool> stop{false};
+    Doorbell bell;
+
+    std::mutex ringsMutex;
+    std::vector<std::unique_ptr<OutputRing>> rings;
+    std::atomic<size_t> ringsVersion{0};
+
+    MpscRing<OutputEvent> shared{1024, WaitStrategy::BusySpin};
+
+    // Publisher thread only
+    std::vector<OutputRing*> activeRings;
+    size_t seenVersion = 0;
+    struct Drained { OutputRing* ring; size_t from; size_t upTo; };
+    std::vector<Drained> drained;
+    std::vector<struct iovec> iov;
+    std::unique_ptr<char[]> text;  // TextFlushBytes, text format only
+    size_t textUsed = 0;
+    std::vector<OutputEvent> sharedBatch;
+};
@@ -0,0 +1,152 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "OrderPool.hpp"
+
+// Describes the prices an instrument can trade at: base, base + tick, ..., base + (levels - 1) * tick
+struct LadderConfig {
+    uint32_t base   = 0;
+    uint32_t tick   = 1;
+    uint32_t levels = 0;
+};
+
+// Three level bitmap over ladder indices: one bit per level, one bit per non-zero word below it
+// and a single root word on top. Finding the next/previous non-empty level is at most three
+// count-zeros instructions whatever the distance, which is what bounds the ladder size to 64^3.
+class LevelBitmap {
+public:
+    static constexpr uint32_t MaxBits = 64u * 64u * 64u;
+
+    explicit LevelBitmap(uint32_t bits)
+        : l0((bits + 63) / 64, 0), l1((bits + 4095) / 4096, 0) { }
+
+    void set(uint32_t i) {
+        l0[i >> 6]  |= bit(i & 63);
+        l1[i >> 12] |= bit((i >> 6) & 63);
+        l2          |= bit(i >> 12);
+    }
+
+    void clear(uint32_t i) {
+        if (l0[i >> 6] &= ~bit(i & 63))
+            return;
+        if (l1[i >> 12] &= ~bit((i >> 6) & 63))
+            return;
+        l2 &= ~bit(i >> 12);
+    }
+
+    // Lowest set index >= i, or -1
+    int64_t next(uint32_t i) const {
+        uint32_t w = i >> 6;
+        if (uint64_t m = l0[w] & ~below(i & 63))
+            return lowest(w, m);
+        uint32_t u = w >> 6;
+        if (uint64_t m = l1[u] & above(w & 63))
+            return lowestIn(u * 64 + ctz(m));
+        if (uint64_t m = l2 & above(u)) {
+            uint32_t u2 = ctz(m);
+            return lowestIn(u2 * 64 + ctz(l1[u2]));
+        }
+        return -1;
+    }
+
+    // Highest set index <= i, or -1
+    int64_t prev(uint32_t i) const {
+        uint32_t w = i >> 6;
+        if (uint64_t m = l0[w] & ~above(i & 63))
+            return highest(w, m);
+        uint32_t u = w >> 6;
+        if (uint64_t m = l1[u] & below(w & 63))
+            return highestIn(u * 64 + msb(m));
+        if (uint64_t m = l2 & below(u)) {
+            uint32_t u2 = msb(m);
+            return highestIn(u2 * 64 + msb(l1[u2]));
+        }
+        return -1;
+    }
+
+private:
+    static uint64_t bit(uint32_t b) { return 1ull << b; }
+    // Bits strictly below / strictly above position b
+    static uint64_t below(uint32_t b) { return bit(b) - 1; }
+    static uint64_t above(uint32_t b) { return b == 63 ? 0 : ~0ull << (b + 1); }
+    static uint32_t ctz(uint64_t m) { return static_cast<uint32_t>(__builtin_ctzll(m)); }
+    static uint32_t msb(uint64_t m) { return 63u - static_cast<uint32_t>(__builtin_clzll(m)); }
+
+    static int64_t lowest(uint32_t w, uint64_t m) { return int64_t(w) * 64 + ctz(m); }
+    static int64_t highest(uint32_t w, uint64_t m) { return int64_t(w) * 64 + msb(m); }
+    int64_t lowestIn(uint32_t w) const { return lowest(w, l0[w]); }
+    int64_t highestIn(uint32_t w) const { return highest(w, l0[w]); }
+
+    std::vector<uint64_t> l0;
+    std::vector<uint64_t> l1;
+    uint64_t l2 = 0;
+};
+
+// Dense array of price levels for one side of a book, indexed by (price - base) / tick.
+// The best level is tracked as a cursor: highest non-empty index for bids, lowest for asks.
+class PriceLadder {
+public:
+    PriceLadder(const LadderConfig& cfg, bool bidSide)
+        : cfg(cfg), bidSide(bidSide), levels(cfg.levels), active(cfg.levels) { }
+
+    static bool valid(const LadderConfig& cfg) {
+        return cfg.tick > 0 && cfg.levels > 0 && cfg.levels <= LevelBitmap::MaxBits;
+    }
+
+    bool contains(uint32_t price) const {
+        if (price < cfg.base)
+            return false;
+        uint32_t off = price - cfg.base;
+        return off % cfg.tick == 0 && off / cfg.tick < cfg.levels;
+    }
+
+    bool empty() const { return best < 0; }
+    uint32_t bestPrice() const { return priceOf(static_cast<uint32_t>(best)); }
+    PriceLevel& bestLevel() { return levels[best]; }
+
+    // Caller must have checked contains(price)
+    PriceLevel& at(uint32_t price) { return levels[indexOf(price)]; }
+
+    // Called when an order is about to be added to the level at price
+    void markActive(uint32_t price) {
+        uint32_t i = indexOf(price);
+        active.set(i);
+        if (best < 0 || (bidSide ? int64_t(i) > best : int64_t(i) < best))
+            best = i;
+    }
+
+    // Called once the level at price has no orders left
+    void markEmpty(uint32_t price) {
+        uint32_t i = indexOf(price);
+        active.clear(i);
+        if (int64_t(i) == best)
+            best = bidSide ? active.prev(i) : active.next(i);
+    }
+
+    // Visits the non-empty levels best first
+    template<typename F>
+    void forEach(F&& f) {
+        forEachWhile([&f](uint32_t price, PriceLevel& lvl) { f(price, lvl); return true; });
+    }
+
+    // Same, until f returns false
+    template<typename F>
+    void forEachWhile(F&& f) {
+        for (int64_t i = best; i >= 0;
+             i = bidSide ? (i == 0 ? -1 : active.prev(uint32_t(i - 1)))
+                         : (i + 1 >= int64_t(cfg.levels) ? -1 : active.next(uint32_t(i + 1))))
+            if (!f(priceOf(uint32_t(i)), levels[i]))
+                return;
+    }
+
+private:
+    uint32_t indexOf(uint32_t price) const { return (price - cfg.base) / cfg.tick; }
+    uint32_t priceOf(uint32_t i) const { return cfg.base + i * cfg.tick; }
+
+    LadderConfig cfg;
+    bool bidSide;
+    std::vector<PriceLevel> levels;
+    LevelBitmap active;
+    int64_t best = -1;
+};
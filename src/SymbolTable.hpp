@@ -0,0 +1,103 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+// Instrument symbol -> T*, looked up on every new order, so lookups take no lock and allocate nothing.
+//
+// A symbol is at most 8 characters, packed into one 64 bit word (NUL padded), which is both the hash input and the key.
+// Entries are only ever added. Readers probe the current table; a writer (callers serialize inserts, it's the slow path
+// taken once per new instrument) stores the value before publishing the key, and when the table needs to grow it builds
+// a bigger copy and swaps the pointer RCU style. A reader still on the old table just doesn't see the newest symbols and
+// falls back to the slow path. Old tables are kept until the SymbolTable goes away, so there's nothing to reclaim.
+template<typename T>
+class SymbolTable {
+public:
+    explicit SymbolTable(size_t initialCapacity = 256) {
+        install(std::make_unique<Table>(initialCapacity));
+    }
+    SymbolTable(const SymbolTable&) = delete;
+    SymbolTable& operator=(const SymbolTable&) = delete;
+
+    // Up to the first 8 characters of symbol as one word, 0 for the empty symbol
+    static uint64_t pack(const char* symbol) {
+        uint64_t key = 0;
+        memcpy(&key, symbol, strnlen(symbol, sizeof(key)));
+        return key;
+    }
+
+    // Any thread, nullptr when the symbol isn't there (yet)
+    T* find(uint64_t key) const {
+        const Table* t = current.load(std::memory_order_acquire);
+        for (size_t i = home(key, t->mask); ; i = (i + 1) & t->mask) {
+            uint64_t k = t->slots[i].key.load(std::memory_order_acquire);
+            if (k == key)
+                return t->slots[i].value.load(std::memory_order_relaxed);
+            if (k == 0)
+                return nullptr;
+        }
+    }
+
+    // key must not be 0 or already present. Inserts must not run concurrently with each other
+    void insert(uint64_t key, T* value) {
+        Table* t = current.load(std::memory_order_relaxed);
+        if ((count + 1) * 2 > t->mask + 1) {
+            auto bigger = std::make_unique<Table>((t->mask + 1) * 2);
+            for (size_t i = 0; i <= t->mask; ++i) {
+                uint64_t k = t->slots[i].key.load(std::memory_order_relaxed);
+                if (k != 0)
+                    place(*bigger, k, t->slots[i].value.load(std::memory_order_relaxed));
+            }
+            t = install(std::move(bigger));
+        }
+        place(*t, key, value);
+        ++count;
+    }
+
+    size_t size() const { return count; }
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> key{0};
+        std::atomic<T*> value{nullptr};
+    };
+
+    struct Table {
+        explicit Table(size_t capacity) {
+            size_t cap = 16;
+            while (cap < capacity)
+                cap <<= 1;
+            mask = cap - 1;
+            slots = std::make_unique<Slot[]>(cap);
+        }
+        size_t mask;
+        std::unique_ptr<Slot[]> slots;
+    };
+
+    static size_t home(uint64_t key, size_t mask) {
+        return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+    }
+
+    static void place(Table& t, uint64_t key, T* value) {
+        size_t i = home(key, t.mask);
+        while (t.slots[i].key.load(std::memory_order_relaxed) != 0)
+            i = (i + 1) & t.mask;
+        t.slots[i].value.store(value, std::memory_order_relaxed);
+        // Publishes the value along with the key
+        t.slots[i].key.store(key, std::memory_order_release);
+    }
+
+    Table* install(std::unique_ptr<Table> t) {
+        Table* raw = t.get();
+        tables.push_back(std::move(t));
+        current.store(raw, std::memory_order_release);
+        return raw;
+    }
+
+    std::atomic<Table*> current{nullptr};
+    std::vector<std::unique_ptr<Table>> tables;
+    size_t count = 0;
+};
@@ -0,0 +1,108 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <endian.h>
+
+#include "io.hpp"
+
+// Compact binary alternative to the text protocol.
+//
+// A client opts in by sending BinaryHandshake as the very first byte of the connection (no text line can start with it).
+// After that the stream is a sequence of frames:
+//
+//   uint16_t length        little-endian, size of the payload that follows
+//   WireCommand payload    little-endian, packed; a cancel may stop right after order_id (length 5), an amend right
+//                          after count (length 13)
+//
+// Payload bytes past the fields this version knows about are skipped, so the payload can grow later.
+
+constexpr uint8_t BinaryHandshake = 0x01;
+
+#pragma pack(push, 1)
+struct WireCommand {
+    uint8_t  type;          // 'B', 'S', 'C' or 'M', same values as CommandType
+    uint32_t order_id;
+    uint32_t price;
+    uint32_t count;
+    char     instrument[8]; // NUL padded, not terminated when all 8 characters are used
+};
+#pragma pack(pop)
+static_assert(sizeof(WireCommand) == 21, "WireCommand is a wire format");
+
+constexpr size_t WireHeaderSize = sizeof(uint16_t);
+constexpr size_t WireCancelSize = offsetof(WireCommand, price);
+constexpr size_t WireAmendSize = offsetof(WireCommand, instrument);
+constexpr size_t WireMaxPayload = 256;
+
+// Writes one frame for cmd into out (at least WireHeaderSize + sizeof(WireCommand) bytes), returns its size
+inline size_t encodeCommand(const ClientCommand& cmd, char* out) {
+    WireCommand w {};
+    w.type = static_cast<uint8_t>(cmd.type);
+    w.order_id = htole32(cmd.order_id);
+    size_t payload = WireCancelSize;
+    if (cmd.type != input_cancel) {
+        w.price = htole32(cmd.price);
+        w.count = htole32(cmd.count);
+        payload = WireAmendSize;
+    }
+    if (cmd.type == input_buy || cmd.type == input_sell) {
+        memcpy(w.instrument, cmd.instrument, strnlen(cmd.instrument, sizeof(w.instrument)));
+        payload = sizeof(WireCommand);
+    }
+    uint16_t len = htole16(static_cast<uint16_t>(payload));
+    memcpy(out, &len, WireHeaderSize);
+    memcpy(out + WireHeaderSize, &w, payload);
+    return WireHeaderSize + payload;
+}
+
+// Decodes the frame at the start of [p, p + avail).
+// Returns the frame size when a whole frame was there, 0 when more bytes are needed, and -1 (with err set) for garbage
+inline ptrdiff_t decodeCommand(const char* p, size_t avail, ClientCommand& out, ParseError& err) {
+    if (avail < WireHeaderSize)
+        return 0;
+    uint16_t len;
+    memcpy(&len, p, WireHeaderSize);
+    len = le16toh(len);
+    if (len < WireCancelSize || len > WireMaxPayload) {
+        err = ParseError::BadFrame;
+        return -1;
+    }
+    if (avail < WireHeaderSize + len)
+        return 0;
+
+    WireCommand w {};
+    memcpy(&w, p + WireHeaderSize, len < sizeof(w) ? len : sizeof(w));
+    switch (w.type) {
+        case input_cancel:
+            break;
+        case input_amend:
+            if (len < WireAmendSize) {
+                err = ParseError::BadFrame;
+                return -1;
+            }
+            break;
+        case input_buy:
+        case input_sell:
+            if (len < sizeof(WireCommand)) {
+                err = ParseError::BadFrame;
+                return -1;
+            }
+            break;
+        default:
+            err = ParseError::UnknownType;
+            return -1;
+    }
+    out.type = static_cast<CommandType>(w.type);
+    out.order_id = le32toh(w.order_id);
+    out.price = le32toh(w.price);
+    out.count = le32toh(w.count);
+    memcpy(out.instrument, w.instrument, sizeof(w.instrument));
+    out.instrument[8] = '\0';
+    if ((out.type == input_buy || out.type == input_sell) && out.instrument[0] == '\0') {
+        err = ParseError::BadInstrument;
+        return -1;
+    }
+    return static_cast<ptrdiff_t>(WireHeaderSize + len);
+}
@@ -13,10 +13,8 @@
 #include <atomic>
 
 #include "io.hpp"
-
-#define INPUT_CANCEL_ORDER 'C'
-#define INPUT_BUY_ORDER 'B'
-#define INPUT_SELL_ORDER 'S'
+#include "CommandParser.hpp"
+#include "WireProtocol.hpp"
 
 char* line_buffer;
 size_t line_buffer_size = 0;
@@ -53,11 +51,13 @@ void* poll_thread(void* fdptr)
 
 int main(int argc, char* argv[])
 {
-    if(argc < 2)
+    if(argc < 2 || (argc > 2 && strcmp(argv[2], "--binary") != 0) || argc > 3)
     {
-        fprintf(stderr, "Usage: %s <path of socket to connect to> < <input>\n", argv[0]);
+        fprintf(stderr, "Usage: %s <path of socket to connect to> [--binary] < <input>\n", argv[0]);
         return 1;
     }
+    // --binary: validate the text input here as usual but send the engine binary frames (WireProtocol.hpp)
+    bool binary = argc > 2;
 
     int clientfd = socket(AF_UNIX, SOCK_STREAM, 0);
     if(clientfd == -1)
@@ -82,6 +82,12 @@ int main(int argc, char* argv[])
 	// not buffered
     setbuf(client, NULL);
 
+    if(binary && fputc(BinaryHandshake, client) == EOF)
+    {
+        fprintf(stderr, "Failed to write handshake\n");
+        return 1;
+    }
+
     pthread_t poll_thread_handle;
     if(pthread_create(&poll_thread_handle, NULL, poll_thread, (void*) (long) clientfd) < 0)
     {
@@ -99,38 +105,27 @@ int main(int argc, char* argv[])
         if(line_buffer[0] == '#' || line_buffer[0] == '\n')
             continue;
 
-        // Parse the command to validate it
+        // Parse the command to validate it, with the same parser the engine uses
         ClientCommand input {};
-        switch(line_buffer[0])
+        ParseError err = parseCommand(line_buffer, input);
+        if(err != ParseError::None)
         {
-            case INPUT_CANCEL_ORDER:
-                input.type = input_cancel;
-                if(sscanf(line_buffer + 1, " %u", &input.order_id) != 1)
-                {
-                    fprintf(stderr, "Invalid cancel order: %s\n", line_buffer);
-                    return 1;
-                }
-                break;
-            case INPUT_BUY_ORDER: 
-                input.type = input_buy; 
-                goto new_order;
-            case INPUT_SELL_ORDER:
-                input.type = input_sell;
-            new_order:
-                if(sscanf(line_buffer + 1, " %u %8s %u %u", &input.order_id, 
-                         input.instrument, &input.price, &input.count) != 4)
-                {
-                    fprintf(stderr, "Invalid new order: %s\n", line_buffer);
-                    return 1;
-                }
-                break;
-            default: 
-                fprintf(stderr, "Invalid command '%c'\n", line_buffer[0]); 
-                return 1;
+            fprintf(stderr, "Invalid command (%s): %s\n", parseErrorString(err), line_buffer);
+            return 1;
         }
 
-        // Send the TEXT line to the server (not binary)
-        if(fwrite(line_buffer, 1, line_length, client) != (size_t)line_length)
+        if(binary)
+        {
+            char frame[WireHeaderSize + sizeof(WireCommand)];
+            size_t frame_length = encodeCommand(input, frame);
+            if(fwrite(frame, 1, frame_length, client) != frame_length)
+            {
+                fprintf(stderr, "Failed to write command\n");
+                return 1;
+            }
+        }
+        // Send the TEXT line to the server
+        else if(fwrite(line_buffer, 1, line_length, client) != (size_t)line_length)
         {
             fprintf(stderr, "Failed to write command\n");
             return 1;
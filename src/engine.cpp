@@ -1,9 +1,93 @@
 #include "engine.hpp"
+#include <algorithm>
 #include <iostream>
+#include "Affinity.hpp"
 #include <thread>
+#include <vector>
 #include "io.hpp"
+#include "CommandParser.hpp"
+
+Engine::Engine(EngineConfig cfg)
+    : config(std::move(cfg)), publisher(config.outputFormat, config.outputFd) {
+    // Explicit cores, or else whatever cores the process may use minus the ones given to I/O and the publisher
+    bool explicitCpus = !config.workerCpus.empty();
+    std::vector<int> cpus = config.workerCpus;
+    if (!explicitCpus) {
+        for (int c : allowedCpus())
+            if (c != config.publisherCpu && std::find(config.ioCpus.begin(), config.ioCpus.end(), c) == config.ioCpus.end())
+                cpus.push_back(c);
+    }
+    size_t workers = config.workers ? config.workers : std::max<size_t>(1, cpus.size());
+    // Automatic placement only pins when every matching thread gets a core of its own
+    bool pin = explicitCpus || workers <= cpus.size();
+    // Set up (and may throw) before any thread is running
+    if (!config.marketDataFeed.empty())
+        marketData = std::make_unique<MarketDataFeed>(config.marketDataFeed, static_cast<uint32_t>(workers), config.marketDataDepth);
+    if (!config.journalDir.empty())
+        journal = std::make_unique<JournalWriter>(config.journalDir, config.journalSync, config.snapshotEvery);
+
+    for (size_t i = 0; i < workers; ++i) {
+        int cpu = pin && !cpus.empty() ? cpus[i % cpus.size()] : -1;
+        MarketDataRing* md = marketData ? &marketData->ring(i) : nullptr;
+        JournalRing* jr = journal ? &journal->createRing() : nullptr;
+        shards.push_back(std::make_unique<MatchingShard>(i, publisher, config.waitStrategy, cpu, config.latency, md, config.marketDataDepth, jr,
+                                                         config.cancelPriority));
+    }
+    publisher.start(config.publisherCpu);
+    // With a journal the shard threads rebuild their books before taking any command, all of them before the journal
+    // thread starts
+    if (journal) {
+        recoverFromJournal();
+        journal->start();
+    } else {
+        for (auto& shard : shards)
+            shard->start();
+    }
+
+    if (config.ioThreads > 0) {
+        reactor = std::make_unique<Reactor>(*this, config.ioThreads, config.ioCpus);
+        reactor->start();
+    }
+}
+
+void Engine::flushOutput() {
+    // The journal first: its last group commit lets go of the output held back for it
+    if (journal)
+        journal->stopAndJoin();
+    publisher.stopAndJoin();
+}
+
+void Engine::recoverFromJournal() {
+    int64_t started = getCurrentTimestamp();
+    std::vector<JournalWriter::Recovered> recovered = journal->recover();
+    size_t commands = 0, snapshots = 0;
+    for (auto& r : recovered) {
+        snapshots += r.snapshot != nullptr;
+        commands += r.count - (r.snapshot ? r.snapshot->journalSeq : 0);
+        // Replayed on the book's own shard thread, so its memory comes from that core's NUMA node (and the shards
+        // replay in parallel)
+        InstrumentWorker& worker = getInstrumentWorker(r.symbol);
+        worker.matchingShard().beforeServing([&worker, r]() mutable {
+            worker.recover(r);
+            JournalWriter::release(r);
+        });
+    }
+    for (auto& shard : shards)
+        shard->start();
+    for (auto& shard : shards)
+        shard->waitUntilServing();
+    if (!recovered.empty())
+        SyncCerr() << "[SERVER] restored " << recovered.size() << " instruments (" << snapshots << " from snapshots, then "
+                   << commands << " journaled commands) from " << journal->directory() << " in "
+                   << (getCurrentTimestamp() - started) / 1000000 << " ms" << std::endl;
+}
 
 void Engine::accept(ClientConnection&& connection) {
+    if (reactor) {
+        // The reactor's I/O threads serve the socket from now on, no thread of its own
+        reactor->addConnection(connection.release());
+        return;
+    }
 
     // Can detach here because its fire and forget, client owns its owm resource (ClientConnection , which is passed via move so no danging ref)
     // In production, u cant join() them so hard to do graceful cleanup, can cause resource leaks or zombie behavipur if misused
@@ -22,9 +106,17 @@ InstrumentWorker& Engine::getInstrumentWorker(const std::string& instrument) {
         // PREV BUG: I only locked here - caused data race , if another thread inserts while this threads reads in line 18, race conditions
         // between checking the hashmap and acquiring the lock, another thread cld be iserting with the same key (or other key n rehashing) -> invaliding iterators
         // foo(std::unique_ptr<T>(new T(a)), g()); // g() might throw → leak risk pre-C++17
-        auto [iterator, success] = instrumentWorkers.emplace(instrument, std::make_unique<InstrumentWorker>(instrument));
+        std::unique_ptr<LatencyStats> latency;
+        if (config.latency)
+            latency = std::make_unique<LatencyStats>();
+        // Round robin, new instruments spread evenly over the pool
+        MatchingShard& shard = *shards[nextShard++ % shards.size()];
+        // Symbols are interned in order of first appearance
+        uint32_t symbolId = static_cast<uint32_t>(instrumentWorkers.size());
+        InstrumentJournal* file = journal ? journal->open(instrument, symbolId) : nullptr;
+        auto [iterator, success] = instrumentWorkers.emplace(instrument, std::make_unique<InstrumentWorker>(instrument, symbolId, orderRouter, shard, ladderFor(instrument), std::move(latency), file));
         auto& worker = *(iterator->second);
-        worker.start();
+        symbols.insert(SymbolTable<InstrumentWorker>::pack(instrument.c_str()), &worker);
         // Emplace creates the A instrument key using copy ctor and worker unique ptr using move ctor, one less memory allocation to OS if u
         // Create before and try to copy or move it in  
         // FYI: unordered_map is node-based— rehash invalidates iterators but does not invalidate pointers/references to elements. Your reference stays valid unless you erase that element.
@@ -33,21 +125,168 @@ InstrumentWorker& Engine::getInstrumentWorker(const std::string& instrument) {
     return *it->second;
 }
 
-void Engine::processClientCommand(const ClientCommand& cmd) {
-    std::string instr(cmd.instrument);
-    auto& worker = getInstrumentWorker(instr);
-    worker.addOrder(cmd);
+std::optional<LadderConfig> Engine::ladderFor(const std::string& instrument) const {
+    auto it = config.ladders.find(instrument);
+    if (it != config.ladders.end())
+        return it->second;
+    return config.defaultLadder;
+}
+
+int64_t Engine::readTimestamp() const {
+    return config.latency ? getCurrentTimestamp() : 0;
+}
+
+void Engine::dumpLatency(std::ostream& out) {
+    if (!config.latency) {
+        out << "[LATENCY] latency tracking is off, start the engine with --latency" << std::endl;
+        return;
+    }
+    out << "[LATENCY] clock " << Clock::source();
+    if (Clock::tscGhz() > 0)
+        out << " at " << Clock::tscGhz() << " GHz";
+    out << '\n';
+    std::vector<std::pair<std::string, const LatencyStats*>> stats;
+    {
+        std::lock_guard<std::mutex> lock(workerMutex);
+        for (auto& [name, worker] : instrumentWorkers)
+            stats.emplace_back(name, worker->latencyStats());
+    }
+    std::sort(stats.begin(), stats.end());
+
+    std::vector<LatencyHistogram::Snapshot> all(LatencyStats::StageCount);
+    for (auto& [name, s] : stats) {
+        for (int i = 0; i < LatencyStats::StageCount; ++i) {
+            auto stage = static_cast<LatencyStats::Stage>(i);
+            // Output rings belong to the shards, so publish is reported per shard below
+            if (stage == LatencyStats::Publish)
+                continue;
+            LatencyHistogram::Snapshot snap = (*s)[stage].snapshot();
+            LatencyStats::print(out, name.c_str(), stage, snap);
+            all[i].add(snap);
+        }
+    }
+    for (auto& shard : shards) {
+        std::string name = "shard" + std::to_string(shard->index());
+        LatencyHistogram::Snapshot snap = shard->publishStage().snapshot();
+        LatencyStats::print(out, name.c_str(), LatencyStats::Publish, snap);
+        all[LatencyStats::Publish].add(snap);
+    }
+    for (int i = 0; i < LatencyStats::StageCount; ++i)
+        LatencyStats::print(out, "*", static_cast<LatencyStats::Stage>(i), all[i]);
+    out.flush();
+}
+
+void Engine::dumpQueues(std::ostream& out) {
+    std::vector<std::pair<std::string, const InstrumentWorker*>> workers;
+    {
+        std::lock_guard<std::mutex> lock(workerMutex);
+        for (auto& [name, worker] : instrumentWorkers)
+            workers.emplace_back(name, worker.get());
+    }
+    std::sort(workers.begin(), workers.end());
+    for (auto& [name, w] : workers)
+        out << "[QUEUE] " << name << " queued=" << w->queuedCommands() << " high=" << w->queueHighWater()
+            << " limit=" << config.queueDepth << " overloads=" << w->overloadCount() << '\n';
+    out.flush();
+}
+
+const char* overloadPolicyName(OverloadPolicy policy) {
+    switch (policy) {
+        case OverloadPolicy::Block: return "block";
+        case OverloadPolicy::Reject: return "reject";
+        case OverloadPolicy::Shed: return "shed";
+    }
+    return "?";
+}
+
+void Engine::processClientCommand(const ClientCommand& cmd, OverloadPolicy overload) {
+    if (cmd.type == input_cancel || cmd.type == input_amend) {
+        // Cancels and amends carry no instrument, the router knows which worker holds the order.
+        // Not routed means it was never added, or already filled / cancelled, so reject right here
+        InstrumentWorker* worker = orderRouter.find(cmd.order_id);
+        if (!worker) {
+            if (cmd.type == input_cancel)
+                publisher.OrderDeleted(cmd.order_id, false, getCurrentTimestamp());
+            else
+                publisher.OrderAmended(cmd.order_id, false, cmd.price, cmd.count, getCurrentTimestamp());
+            return;
+        }
+        if (admit(*worker, cmd, overload))
+            enqueue(*worker, cmd);
+        return;
+    }
+
+    // No string, no lock: the symbol is hashed as one word. Only a new instrument takes the slow path
+    InstrumentWorker* known = symbols.find(SymbolTable<InstrumentWorker>::pack(cmd.instrument));
+    auto& worker = known ? *known : getInstrumentWorker(cmd.instrument);
+    // A refused order never gets routed, a cancel for it is rejected like one for any unknown id
+    if (!admit(worker, cmd, overload))
+        return;
+    // Route before enqueueing, so a cancel sent right behind this add already finds the worker
+    orderRouter.insert(cmd.order_id, &worker);
+    enqueue(worker, cmd);
+}
+
+bool Engine::admit(InstrumentWorker& worker, const ClientCommand& cmd, OverloadPolicy overload) {
+    if (worker.tryAdmit(config.queueDepth))
+        return true;
+    // Once per instrument, the [QUEUE] lines on SIGUSR1 have the counts
+    if (worker.countOverload() == 0)
+        SyncCerr() << "[SERVER] " << worker.symbol() << " has " << config.queueDepth << " commands queued (overload policy "
+                   << overloadPolicyName(overload) << ")" << std::endl;
+    switch (overload) {
+        case OverloadPolicy::Block:
+            for (unsigned spins = 0; !worker.tryAdmit(config.queueDepth); ++spins) {
+                if (spins < 1024)
+                    cpuRelax();
+                else
+                    std::this_thread::yield();
+            }
+            return true;
+        case OverloadPolicy::Shed:
+            if (cmd.type == input_cancel) {
+                worker.forceAdmit();
+                return true;
+            }
+            [[fallthrough]];
+        case OverloadPolicy::Reject:
+            break;
+    }
+    publisher.OrderRefused(cmd.order_id, static_cast<char>(cmd.type), getCurrentTimestamp());
+    return false;
+}
+
+void Engine::enqueue(InstrumentWorker& worker, const ClientCommand& cmd) {
+    if (cmd.read_ts == 0) {
+        worker.addOrder(cmd);
+        return;
+    }
+    ClientCommand stamped = cmd;
+    stamped.enqueue_ts = getCurrentTimestamp();
+    worker.addOrder(stamped);
 }
 
 
 void Engine::connection_thread(ClientConnection&& conn) {
+    // Connection threads come and go, so they share the I/O cores rather than getting one each
+    if (!pinThisThread(config.ioCpus))
+        SyncCerr() << "[SERVER] could not pin connection thread to the I/O cpus" << std::endl;
+    ClientCommand cmds[64];
     while (true) {
-        ClientCommand cmd;
-        ReadResult res = conn.readInput(cmd);
-        if (res == ReadResult::Error || res == ReadResult::EndOfFile)
+        size_t count = 0;
+        ReadResult res = conn.readInput(cmds, 64, count);
+        if (res == ReadResult::Error || res == ReadResult::EndOfFile) {
+            if (conn.parseError() != ParseError::None)
+                SyncCerr() << "[SERVER] dropping client: " << parseErrorString(conn.parseError()) << std::endl;
             // When return, this thread is cleaned up automatically 
             return;
-        processClientCommand(cmd);
+        }
+        // Stamped once the batch is out of the receive buffer, which includes the blocking read behind it
+        int64_t readTs = readTimestamp();
+        for (size_t i = 0; i < count; ++i) {
+            cmds[i].read_ts = readTs;
+            processClientCommand(cmds[i]);
+        }
     }
 }
 
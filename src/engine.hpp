@@ -3,38 +3,137 @@
 #include <atomic>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <string>
 #include <unordered_map>
 #include <queue>
+#include <vector>
 
 #include "io.hpp"
+#include "Clock.hpp"
+#include "LatencyStats.hpp"
 #include "InstrumentWorker.hpp"
+#include "Journal.hpp"
+#include "MarketDataFeed.hpp"
+#include "MatchingShard.hpp"
+#include "SymbolTable.hpp"
+#include "reactor.hpp"
+
+// What a connection does with a command whose instrument already has EngineConfig::queueDepth commands queued
+enum class OverloadPolicy {
+    Block,   // its reader waits for room, so the client's own socket backs up
+    Reject,  // the command is refused with an 'R' event
+    Shed     // new orders and amends are refused with an 'R' event, cancels are still let through
+};
+
+const char* overloadPolicyName(OverloadPolicy policy);
+
+// Startup options, filled in from the command line by main
+struct EngineConfig {
+    // Instruments listed here (or every instrument, with defaultLadder) start with dense price ladders
+    std::unordered_map<std::string, LadderConfig> ladders;
+    std::optional<LadderConfig> defaultLadder;
+    // Matching threads, every instrument's book runs on one of them. 0: one per CPU the engine may run on
+    size_t workers = 0;
+    // How matching threads wait on an empty command queue
+    WaitStrategy waitStrategy = WaitStrategy::SpinFutex;
+    // Text lines (what the engine has always printed) or raw OutputEvent records on stdout
+    OutputPublisher::Format outputFormat = OutputPublisher::Format::Text;
+    // Where the publisher writes, stdout unless embedded (e.g. by bench/loadgen)
+    int outputFd = 1;
+    // 0: one thread per connection. Otherwise the number of epoll I/O threads serving all connections
+    size_t ioThreads = 0;
+    // Cores for the matching threads (shard i on workerCpus[i % size]), the I/O threads (reactor thread i on
+    // ioCpus[i % size], connection threads may use all of them) and the output publisher. Empty / -1: not pinned,
+    // except that matching threads are spread over the remaining allowed cores when there are enough of them
+    std::vector<int> workerCpus;
+    std::vector<int> ioCpus;
+    int publisherCpu = -1;
+    // Stamp every command on its way through and keep per instrument latency histograms, see LatencyStats.hpp
+    bool latency = false;
+    // Shared memory name (e.g. /orderbook-md) of the L2 market data feed, none when empty. See MarketDataFeed.hpp
+    std::string marketDataFeed;
+    // Levels per side in the feed's periodic snapshots
+    uint32_t marketDataDepth = 10;
+    // Directory of the per instrument command journals, none when empty. Whatever is in there is replayed at startup
+    std::string journalDir;
+    // fdatasync each batch of journal writes, otherwise they're only safe from a crash of the engine, not of the machine
+    bool journalSync = true;
+    // Commands between two snapshots of a book, which bound how much of its journal a restart replays. 0: never
+    uint64_t snapshotEvery = 1000000;
+    // Commands an instrument may have queued before the overload policy kicks in, 0: only bounded by its shard's queue
+    uint32_t queueDepth = 4096;
+    // Default for every connection
+    OverloadPolicy overload = OverloadPolicy::Block;
+    // Cancels get a queue of their own on every matching thread, drained ahead of new orders. See MatchingShard
+    bool cancelPriority = false;
+};
 
 class Engine {
 public:
+    Engine() : Engine(EngineConfig{}) { }
+    explicit Engine(EngineConfig cfg);
+
+    // Writes out all pending output and journal records and stops the publisher and the journal, called on the way
+    // out of the process
+    void flushOutput();
+
     // Accept incoming client connection
     void accept(ClientConnection&& conn);
 
-    // Entry point for a parsed ClientCommand
-    void processClientCommand(const ClientCommand& cmd);
+    // Entry point for a parsed ClientCommand, with config.overload or the connection's own policy
+    void processClientCommand(const ClientCommand& cmd) { processClientCommand(cmd, config.overload); }
+    void processClientCommand(const ClientCommand& cmd, OverloadPolicy overload);
 
-    // Lookup (or create) the worker for this instrument
+    // Lookup (or create) the worker for this instrument. Takes workerMutex, processClientCommand only comes here
+    // for instruments it hasn't seen yet
     InstrumentWorker& getInstrumentWorker(const std::string& instrument);
 
+    // Percentiles of every latency stage, per instrument and over all of them (needs config.latency)
+    void dumpLatency(std::ostream& out);
+
+    // Queued commands, high-water mark and overloads of every instrument
+    void dumpQueues(std::ostream& out);
+
+    // Read stamp for commands that just came off a socket, 0 when latency tracking is off
+    int64_t readTimestamp() const;
+
 private:
     void connection_thread(ClientConnection&& conn);
+    // Takes a place in the worker's queue for cmd, or applies the overload policy. False: cmd was refused
+    bool admit(InstrumentWorker& worker, const ClientCommand& cmd, OverloadPolicy overload);
+    // Pushes onto the worker's queue, stamping the enqueue time when the command carries a read stamp
+    void enqueue(InstrumentWorker& worker, const ClientCommand& cmd);
+    std::optional<LadderConfig> ladderFor(const std::string& instrument) const;
+    // Replays every journal in config.journalDir on the shard threads, starting them, and returns once they're done
+    void recoverFromJournal();
+
+    EngineConfig config;
+    // The workers and shards hold its files and rings, and output held back for the journal reads its progress, so
+    // it's declared before both the publisher and the workers
+    std::unique_ptr<JournalWriter> journal;
+    // Declared before the workers, which each hold one of its rings
+    OutputPublisher publisher;
+
+    // Declared before the workers, which hold a reference to it
+    OrderRouter orderRouter;
 
     // Per-instrument workers
     // Can be pointer bc im not gonna delete the InstrumentWorker in my program 
     std::unordered_map<std::string, std::unique_ptr<InstrumentWorker>> instrumentWorkers;
     std::mutex workerMutex;
+    // Lock-free view of instrumentWorkers for the order path, inserted into under workerMutex
+    SymbolTable<InstrumentWorker> symbols;
+    // Next shard a new instrument goes to (under workerMutex)
+    size_t nextShard = 0;
 
-};
-
+    // One ring per shard, declared before the shards that write to it
+    std::unique_ptr<MarketDataFeed> marketData;
 
-inline std::chrono::microseconds::rep getCurrentTimestamp() 
+    // The matching thread pool. Declared after the workers so the threads are stopped before any book goes away
+    std::vector<std::unique_ptr<MatchingShard>> shards;
 
-{
-	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
-}
+    // Only with config.ioThreads > 0. Last member, its threads call back into everything above
+    std::unique_ptr<Reactor> reactor;
 
+};
@@ -3,10 +3,13 @@
 
 #include <fcntl.h>
 #include <unistd.h>
+#include <cerrno>
 #include <cstring>
 #include <cstdio>
 
 #include "io.hpp"
+#include "CommandParser.hpp"
+#include "WireProtocol.hpp"
 #include "engine.hpp"
 
 // out of line definitions for the mutexes in SyncCerr/SyncCout
@@ -25,74 +28,103 @@ void ClientConnection::freeHandle()
 	}
 }
 
-#include <unistd.h>
+void RecvBuffer::finish() {
+    if (m_mode == Mode::Binary || (m_mode == Mode::Unknown && !empty() && static_cast<uint8_t>(m_data[m_begin]) == BinaryHandshake)) {
+        // A truncated last frame is just dropped
+        return;
+    }
+    if (m_end > m_begin && m_data[m_end - 1] != '\n') {
+        m_data[m_end++] = '\n';
+    }
+}
 
+ReadResult RecvBuffer::parse(ClientCommand* out, size_t max, size_t& count) {
+    count = 0;
+    if (m_mode == Mode::Unknown) {
+        if (empty()) {
+            return ReadResult::Success;
+        }
+        // Text lines never start with the handshake byte, so one byte is enough to tell
+        if (static_cast<uint8_t>(m_data[m_begin]) == BinaryHandshake) {
+            m_mode = Mode::Binary;
+            ++m_begin;
+        } else {
+            m_mode = Mode::Text;
+        }
+    }
+    return m_mode == Mode::Binary ? parseBinary(out, max, count) : parseText(out, max, count);
+}
 
-static ssize_t readLine(int fd, char* buf, size_t max) {
-    ssize_t total = 0;
-    while (total < static_cast<ssize_t>(max) - 1) {
-        char c;
-        ssize_t n = read(fd, &c, 1);
+ReadResult RecvBuffer::parseBinary(ClientCommand* out, size_t max, size_t& count) {
+    while (count < max) {
+        // Bounds check and a memcpy per frame, no text to scan
+        ptrdiff_t n = decodeCommand(m_data + m_begin, m_end - m_begin, out[count], m_error);
         if (n < 0) {
-            // Read error
-            return -1;
+            return ReadResult::Error;
         }
         if (n == 0) {
-            // EOF reached
-            break;
-        }
-        buf[total++] = c;
-        if (c == '\n') {
-            break;
+            return ReadResult::Success;
         }
+        m_begin += n;
+        ++count;
     }
-    buf[total] = '\0';
-    return total;
+    return ReadResult::Success;
 }
 
-ReadResult ClientConnection::readInput(ClientCommand& read_into) {
-    const size_t bufferSize = 256;
-    char buffer[bufferSize];
-    
-    ssize_t n = readLine(m_handle, buffer, bufferSize);
-    // If the client does ctrl D, n will be -1
-    if (n < 0) {
-        return ReadResult::Error;
-    }
-    if (n == 0) {
-        return ReadResult::EndOfFile;
-    }
-    
-    if (buffer[0] == '#' || buffer[0] == '\n') {
-        return ReadResult::Success;
-    }
-    
-    memset(&read_into, 0, sizeof(ClientCommand));
-    
-    char typeChar;
-    if (sscanf(buffer, " %c", &typeChar) != 1) {
-        return ReadResult::Error;
+ReadResult RecvBuffer::parseText(ClientCommand* out, size_t max, size_t& count) {
+    while (count < max) {
+        char* line = m_data + m_begin;
+        char* nl = findNewline(line, m_data + m_end);
+        if (!nl) {
+            // Only a partial line left. If it already fills the whole buffer it's never going to end
+            return (m_begin == 0 && m_end >= Capacity - 1) ? ReadResult::Error : ReadResult::Success;
+        }
+        *nl = '\0';
+        m_begin = nl + 1 - m_data;
+        if (isIgnoredLine(line))
+            continue;
+        m_error = parseCommand(line, out[count]);
+        if (m_error != ParseError::None)
+            return ReadResult::Error;
+        ++count;
     }
-    
-    
-    if (typeChar == 'B' || typeChar == 'S') {
-        // %8s puts up to 8 chars for instrument (fits my char instrument[9], leaving room for null terminator)
-        int ret = sscanf(buffer, " %c %u %8s %u %u", &typeChar, &read_into.order_id, read_into.instrument, &read_into.price, &read_into.count);
-        if (ret != 5) {
+    return ReadResult::Success;
+}
+
+ReadResult ClientConnection::readInput(ClientCommand* read_into, size_t max, size_t& count) {
+    count = 0;
+    while (true) {
+        if (m_failed) {
             return ReadResult::Error;
         }
-        read_into.type = static_cast<CommandType>(typeChar);
-    } else if (typeChar == 'C') {
-        // Format: <Type> <order_id>
-        int ret = sscanf(buffer, " %c %u", &typeChar, &read_into.order_id);
-        if (ret != 2) {
+        if (m_buffer->parse(read_into, max, count) == ReadResult::Error) {
+            m_failed = true;
+            // Hand out what came before the bad line first
+            if (count > 0) {
+                return ReadResult::Success;
+            }
+            return ReadResult::Error;
+        }
+        if (count > 0) {
+            return ReadResult::Success;
+        }
+        if (m_eof) {
+            return ReadResult::EndOfFile;
+        }
+
+        // One read for as much as the client has sent, instead of one per byte
+        ssize_t n = read(m_handle, m_buffer->writePtr(), m_buffer->writable());
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
             return ReadResult::Error;
         }
-        read_into.type = static_cast<CommandType>(typeChar);
-    } else {
-        return ReadResult::Error;
+        if (n == 0) {
+            m_eof = true;
+            m_buffer->finish();
+            continue;
+        }
+        m_buffer->commit(n);
     }
-    
-    return ReadResult::Success;
 }
-
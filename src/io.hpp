@@ -2,15 +2,19 @@
 #pragma once
 
 #include <mutex>
+#include <memory>
 #include <utility>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
 
 enum CommandType
 {
 	input_buy = 'B',
 	input_sell = 'S',
-	input_cancel = 'C'
+	input_cancel = 'C',
+	// Changes the price and / or size of a resting order: M <id> <price> <count>, no instrument
+	input_amend = 'M'
 };
 
 struct ClientCommand
@@ -20,6 +24,22 @@ struct ClientCommand
 	uint32_t price;
 	uint32_t count;
 	char instrument[9];
+	// Only stamped with --latency (0 otherwise): when the command came off the socket and when it was queued for its worker
+	int64_t read_ts = 0;
+	int64_t enqueue_ts = 0;
+};
+
+// Why a text command line was rejected
+enum class ParseError : uint8_t
+{
+	None,
+	Empty,          // nothing but whitespace
+	UnknownType,    // first character isn't B, S, C or M
+	BadOrderId,
+	BadInstrument,
+	BadPrice,
+	BadCount,
+	BadFrame,       // binary protocol: length out of range / too short for the command
 };
 
 enum class ReadResult
@@ -29,17 +49,71 @@ enum class ReadResult
 	Error
 };
 
+// Per-connection receive buffer: the socket is read in large chunks and the bytes are split into lines in place,
+// instead of one read(2) per byte. A line cut in half by a read stays in the buffer until the rest arrives.
+class RecvBuffer
+{
+public:
+	static constexpr size_t Capacity = 64 * 1024;
+
+	// Free space to read(2) into, compacting the unparsed tail to the front first
+	char* writePtr()
+	{
+		if (m_begin > 0)
+		{
+			memmove(m_data, m_data + m_begin, m_end - m_begin);
+			m_end -= m_begin;
+			m_begin = 0;
+		}
+		return m_data + m_end;
+	}
+	// Leaves room for the newline finish() may add
+	size_t writable() const { return Capacity - 1 - m_end; }
+	void commit(size_t n) { m_end += n; }
+
+	// At EOF: a last text line without a newline still counts as a line
+	void finish();
+
+	bool empty() const { return m_begin == m_end; }
+
+	// Parses complete lines (or binary frames, if the client opened with the handshake byte) into out[0..max),
+	// skipping comments and blank lines, and reports how many it filled in.
+	// Error means a malformed line (or a line that can't fit in the buffer); the commands before it are still in out.
+	// Success with count == 0 means more bytes are needed
+	ReadResult parse(ClientCommand* out, size_t max, size_t& count);
+
+	// Why the last Error from parse happened (None for a line that didn't fit in the buffer)
+	ParseError parseError() const { return m_error; }
+
+	bool binary() const { return m_mode == Mode::Binary; }
+
+private:
+	// Decided by the first byte the client sends, see WireProtocol.hpp
+	enum class Mode : uint8_t { Unknown, Text, Binary };
+
+	ReadResult parseText(ClientCommand* out, size_t max, size_t& count);
+	ReadResult parseBinary(ClientCommand* out, size_t max, size_t& count);
+
+	Mode m_mode = Mode::Unknown;
+	ParseError m_error = ParseError::None;
+	size_t m_begin = 0;  // first byte not parsed yet
+	size_t m_end = 0;    // one past the last byte read
+	char m_data[Capacity];
+};
+
 struct ClientConnection
 {
 	~ClientConnection() { this->freeHandle(); }
 	// explicit constructor
-	explicit ClientConnection(int handle) : m_handle(handle) { }
+	explicit ClientConnection(int handle) : m_handle(handle), m_buffer(std::make_unique<RecvBuffer>()) { }
     
 	// move constructor, this takes the other's m handle and makes the other's m handle -1 , which is not a valid FD
 	// called when ClientConnection a(std::move(b)); or ClientConnection(std::move(b));
 	// Move constructor happens when constructing a brand-new object from an rvalue.
 
-	ClientConnection(ClientConnection&& other) : m_handle(std::exchange(other.m_handle, -1)) { }
+	ClientConnection(ClientConnection&& other)
+	    : m_handle(std::exchange(other.m_handle, -1)), m_buffer(std::move(other.m_buffer)),
+	      m_eof(other.m_eof), m_failed(other.m_failed) { }
 	// overloaded =, move assignment operator
 	// a = std::move(b);
 	// Move assignment happens when assigning to an existing object from an rvalue.
@@ -50,6 +124,9 @@ struct ClientConnection
 
 		this->freeHandle();
 		m_handle = std::exchange(other.m_handle, -1);
+		m_buffer = std::move(other.m_buffer);
+		m_eof = other.m_eof;
+		m_failed = other.m_failed;
 
 		return *this;
 	}
@@ -61,14 +138,31 @@ struct ClientConnection
 	// delete the copy assignment operator 
 	ClientConnection& operator=(const ClientConnection&) = delete;
 
-	ReadResult readInput(ClientCommand& read_into);
+	// Blocks until at least one command is available, then returns every complete command already buffered (up to max).
+	// A malformed line ends the connection: the commands before it are returned first, Error on the next call
+	ReadResult readInput(ClientCommand* read_into, size_t max, size_t& count);
+
+	// Gives up ownership of the socket (e.g. to hand it to the reactor), the connection no longer closes it
+	int release() { return std::exchange(m_handle, -1); }
+
+	ParseError parseError() const { return m_buffer ? m_buffer->parseError() : ParseError::None; }
 
 private:
 	int m_handle;
+	std::unique_ptr<RecvBuffer> m_buffer;
+	bool m_eof = false;
+	bool m_failed = false;
 	void freeHandle();
 };
 
 
+// Comment and blank lines carry no command and are skipped
+inline bool isIgnoredLine(const char* line)
+{
+	return line[0] == '#' || line[0] == '\n' || line[0] == '\0';
+}
+
+
 // An implementation of std::osyncstream{std::cout}
 // std::osyncstream would work but badly supported right now
 struct SyncCout {
@@ -115,48 +209,3 @@ struct SyncCerr {
         return *this;
     }
 };
-
-class Output
-{
-public:
-	inline static void
-	OrderAdded(uint32_t id, const char* symbol, uint32_t price, uint32_t count, bool is_sell_side, intmax_t output_timestamp)
-	{
-		SyncCout()
-		    << (is_sell_side ? "S " : "B ") //
-		    << id << " "                    //
-		    << symbol << " "                //
-		    << price << " "                 //
-		    << count << " "                 //
-		    << output_timestamp             //
-		    << std::endl;
-	}
-
-	inline static void OrderExecuted(uint32_t resting_id,
-	    uint32_t new_id,
-	    uint32_t execution_id,
-	    uint32_t price,
-	    uint32_t count,
-	    intmax_t output_timestamp)
-	{
-		SyncCout()
-		    << "E "                //
-		    << resting_id << " "   //
-		    << new_id << " "       //
-		    << execution_id << " " //
-		    << price << " "        //
-		    << count << " "        //
-		    << output_timestamp    //
-		    << std::endl;
-	}
-
-	inline static void OrderDeleted(uint32_t id, bool cancel_accepted, intmax_t output_timestamp)
-	{
-		SyncCout()
-		    << "X "                            //
-		    << id << " "                       //
-		    << (cancel_accepted ? "A " : "R ") //
-		    << output_timestamp                //
-		    << std::endl;
-	}
-};
@@ -1,32 +1,37 @@
+#include <ctype.h>
 #include <stdio.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
 
 #include "io.hpp"
 #include "engine.hpp"
+#include "Affinity.hpp"
 
 static int listenfd = -1;
 static char* socketpath = NULL;
-
-
-// Signal handler
-
-static void handle_exit_signal(int signum)
-{
-    (void) signum; // tells compiler im not using this signum
-
-	// do the exit cleanup code before terminating process immeditaley
-    exit(0);
-}
+static Engine* engine = NULL;
+static std::string marketDataFeed;
 
 
 static void exit_cleanup(void)
 {
+    // output is written by a publisher thread, make sure whatever it hasn't written yet isn't lost
+    if (engine)
+        engine->flushOutput();
+    // Readers that are still attached keep their mapping, the name just goes away
+    if (!marketDataFeed.empty())
+        shm_unlink(marketDataFeed.c_str());
     if (listenfd == -1)
         return;
     // on process exit, closes the listening file FD and removed the socket file from the filesystem
@@ -36,11 +41,176 @@ static void exit_cleanup(void)
         unlink(socketpath);
 }
 
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+        "Usage: %s <socket path> [options]\n"
+        "  --ladder=[SYMBOL:]<base>:<tick>:<levels>   dense price ladder for SYMBOL (or every instrument)\n"
+        "  --workers=<threads>                        matching threads shared by all instruments (default one per cpu)\n"
+        "  --wait=spin|yield|futex                    how idle matching threads wait for commands (default futex)\n"
+        "  --output=text|binary                       output as text lines (default) or raw 40 byte event records\n"
+        "  --reactor[=<threads>]                      serve all clients from epoll I/O threads (default 2) instead of a thread each\n"
+        "  --latency                                  track per stage latency, kill -USR1 prints percentiles to stderr\n"
+        "  --cpu-workers=<cpus>                       pin matching threads to these cores, e.g. 2-5 or 2,4,6\n"
+        "  --cpu-io=<cpus>                            pin I/O threads (reactor or per connection) to these cores\n"
+        "  --cpu-publisher=<cpu>                      pin the output publisher to this core\n"
+        "  --md-feed=</name>                          publish L2 market data to this shared memory segment\n"
+        "  --md-depth=<levels>                        levels per side in the market data snapshots (default 10)\n"
+        "  --journal=<dir>                            journal every command per instrument, replay it at startup\n"
+        "  --journal-nosync                           write the journal without fdatasync\n"
+        "  --snapshot-every=<commands>                snapshot a journaled book every so many commands (default 1000000, 0: never)\n"
+        "  --queue-depth=<commands>                   commands queued per instrument before overload (default 4096, 0: no limit)\n"
+        "  --overload=block|reject|shed               on overload wait, refuse the command, or refuse new orders only (default block)\n"
+        "  --cancel-priority                          cancels skip ahead of queued new orders (never ahead of their own)\n",
+        prog);
+}
+
+// --ladder=AAPL:10000:1:20000 or --ladder=10000:1:20000 for all instruments
+static bool parse_ladder(const char* spec, EngineConfig& config)
+{
+    char symbol[9] = {0};
+    LadderConfig ladder;
+    int consumed = 0;
+    if (sscanf(spec, "%u:%u:%u%n", &ladder.base, &ladder.tick, &ladder.levels, &consumed) == 3 && spec[consumed] == '\0')
+    {
+        if (!PriceLadder::valid(ladder))
+            return false;
+        config.defaultLadder = ladder;
+        return true;
+    }
+    if (sscanf(spec, "%8[^:]:%u:%u:%u%n", symbol, &ladder.base, &ladder.tick, &ladder.levels, &consumed) == 4 && spec[consumed] == '\0')
+    {
+        if (!PriceLadder::valid(ladder))
+            return false;
+        config.ladders[symbol] = ladder;
+        return true;
+    }
+    return false;
+}
+
+static bool parse_wait(const char* spec, EngineConfig& config)
+{
+    if (strcmp(spec, "spin") == 0)
+        config.waitStrategy = WaitStrategy::BusySpin;
+    else if (strcmp(spec, "yield") == 0)
+        config.waitStrategy = WaitStrategy::SpinYield;
+    else if (strcmp(spec, "futex") == 0)
+        config.waitStrategy = WaitStrategy::SpinFutex;
+    else
+        return false;
+    return true;
+}
+
+static bool parse_overload(const char* spec, EngineConfig& config)
+{
+    if (strcmp(spec, "block") == 0)
+        config.overload = OverloadPolicy::Block;
+    else if (strcmp(spec, "reject") == 0)
+        config.overload = OverloadPolicy::Reject;
+    else if (strcmp(spec, "shed") == 0)
+        config.overload = OverloadPolicy::Shed;
+    else
+        return false;
+    return true;
+}
+
+static bool parse_output(const char* spec, EngineConfig& config)
+{
+    if (strcmp(spec, "text") == 0)
+        config.outputFormat = OutputPublisher::Format::Text;
+    else if (strcmp(spec, "binary") == 0)
+        config.outputFormat = OutputPublisher::Format::Binary;
+    else
+        return false;
+    return true;
+}
+
 int main(int argc, char* argv[])
 {
     if (argc < 2)
     {
-        fprintf(stderr, "Usage: %s <socket path>\n", argv[0]);
+        usage(argv[0]);
+        return 1;
+    }
+
+    EngineConfig config;
+    for (int i = 2; i < argc; ++i)
+    {
+        if (strncmp(argv[i], "--ladder=", 9) == 0 && parse_ladder(argv[i] + 9, config))
+            continue;
+        if (strncmp(argv[i], "--wait=", 7) == 0 && parse_wait(argv[i] + 7, config))
+            continue;
+        if (strncmp(argv[i], "--output=", 9) == 0 && parse_output(argv[i] + 9, config))
+            continue;
+        if (strncmp(argv[i], "--workers=", 10) == 0 && atoi(argv[i] + 10) > 0)
+        {
+            config.workers = atoi(argv[i] + 10);
+            continue;
+        }
+        if (strncmp(argv[i], "--cpu-workers=", 14) == 0 && parseCpuList(argv[i] + 14, config.workerCpus))
+            continue;
+        if (strncmp(argv[i], "--cpu-io=", 9) == 0 && parseCpuList(argv[i] + 9, config.ioCpus))
+            continue;
+        std::vector<int> publisherCpu;
+        if (strncmp(argv[i], "--cpu-publisher=", 16) == 0 && parseCpuList(argv[i] + 16, publisherCpu) && publisherCpu.size() == 1)
+        {
+            config.publisherCpu = publisherCpu[0];
+            continue;
+        }
+        if (strcmp(argv[i], "--latency") == 0)
+        {
+            config.latency = true;
+            continue;
+        }
+        if (strncmp(argv[i], "--md-feed=", 10) == 0 && argv[i][10] == '/' && argv[i][11] != '\0' && !strchr(argv[i] + 11, '/'))
+        {
+            config.marketDataFeed = argv[i] + 10;
+            continue;
+        }
+        if (strncmp(argv[i], "--md-depth=", 11) == 0 && atoi(argv[i] + 11) > 0)
+        {
+            config.marketDataDepth = atoi(argv[i] + 11);
+            continue;
+        }
+        if (strncmp(argv[i], "--journal=", 10) == 0 && argv[i][10] != '\0')
+        {
+            config.journalDir = argv[i] + 10;
+            continue;
+        }
+        if (strncmp(argv[i], "--snapshot-every=", 17) == 0 && isdigit((unsigned char)argv[i][17]))
+        {
+            config.snapshotEvery = strtoull(argv[i] + 17, NULL, 10);
+            continue;
+        }
+        if (strcmp(argv[i], "--journal-nosync") == 0)
+        {
+            config.journalSync = false;
+            continue;
+        }
+        if (strncmp(argv[i], "--queue-depth=", 14) == 0 && isdigit((unsigned char)argv[i][14]))
+        {
+            config.queueDepth = static_cast<uint32_t>(strtoul(argv[i] + 14, NULL, 10));
+            continue;
+        }
+        if (strncmp(argv[i], "--overload=", 11) == 0 && parse_overload(argv[i] + 11, config))
+            continue;
+        if (strcmp(argv[i], "--cancel-priority") == 0)
+        {
+            config.cancelPriority = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--reactor") == 0)
+        {
+            config.ioThreads = 2;
+            continue;
+        }
+        if (strncmp(argv[i], "--reactor=", 10) == 0 && atoi(argv[i] + 10) > 0)
+        {
+            config.ioThreads = atoi(argv[i] + 10);
+            continue;
+        }
+        fprintf(stderr, "Invalid option: %s\n", argv[i]);
+        usage(argv[0]);
         return 1;
     }
 
@@ -67,9 +237,16 @@ int main(int argc, char* argv[])
     }
 
     atexit(exit_cleanup);
-	// you are trapping sigint and sigterm so they call handle_exit_signal 
-    signal(SIGINT, handle_exit_signal);
-    signal(SIGTERM, handle_exit_signal);
+
+    // SIGUSR1 dumps the latency histograms, SIGINT and SIGTERM shut down. They're blocked here, before any other thread
+    // exists (they all inherit the mask), and taken with sigwait on a thread of its own, so the dump and the cleanup
+    // can lock, allocate and join threads like normal code, which a real signal handler can't
+    sigset_t handled;
+    sigemptyset(&handled);
+    sigaddset(&handled, SIGUSR1);
+    sigaddset(&handled, SIGINT);
+    sigaddset(&handled, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &handled, NULL);
 
     if (listen(listenfd, 8) != 0)
     {
@@ -80,7 +257,29 @@ int main(int argc, char* argv[])
 
     fflush(stdout);
 
-    auto engine = new Engine();
+    marketDataFeed = config.marketDataFeed;
+    try
+    {
+        engine = new Engine(std::move(config));
+    }
+    catch (const std::exception& ex)
+    {
+        fprintf(stderr, "[SERVER] %s\n", ex.what());
+        return 1;
+    }
+    std::thread([handled]() {
+        int sig;
+        while (sigwait(&handled, &sig) == 0)
+        {
+            if (sig != SIGUSR1)
+                // exit_cleanup runs here, on this thread: the journal's last group commit and the publisher's last
+                // write happen before the process goes
+                exit(0);
+            SyncCerr lock;
+            engine->dumpLatency(std::cerr);
+            engine->dumpQueues(std::cerr);
+        }
+    }).detach();
     while (true)
     {
         fflush(stdout);
@@ -0,0 +1,268 @@
+// Follows an engine's --md-feed segment and checks it: every instrument's depth is kept from the 'U' level updates
+// and compared with each snapshot ('S', its 'L' levels, 'E') that comes by. A snapshot must also be in order (bids
+// best first, then asks best first, no more than the feed's depth per side, not crossed). A book is only checked once
+// the reader is in sync with it, from its first snapshot on and again after the writer lapped the reader.
+//
+// A side whose snapshot was full (depth levels) may have more levels behind it the reader never saw, so it is only
+// taken over from the next snapshots until one shows all of it.
+//
+// Once nothing has come for --idle milliseconds (default 2000) it prints every book's depth, one line per level:
+// <symbol> B|S <price> <quantity> <orders>, bids best first, then asks best first, and a summary to stderr. The exit
+// status is 1 if anything didn't add up.
+//
+// Usage: mdcheck </name> [--idle=<ms>]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "MarketDataFeed.hpp"
+
+namespace {
+
+struct Level {
+    uint64_t quantity;
+    uint32_t orders;
+    bool operator==(const Level& other) const { return quantity == other.quantity && orders == other.orders; }
+};
+
+struct Book {
+    std::string symbol;
+    size_t ring = 0;
+    bool synced = false;
+    std::map<uint32_t, Level, std::greater<uint32_t>> bids;
+    std::map<uint32_t, Level> asks;
+    // Sides taken from a full snapshot, there may be more levels behind
+    bool bidsPartial = false;
+    bool asksPartial = false;
+    // The snapshot being received, between 'S' and 'E'
+    bool inSnapshot = false;
+    std::vector<MarketDataEvent> snapshot;
+};
+
+class Checker {
+public:
+    explicit Checker(uint32_t depth) : depth(depth) { }
+
+    void apply(size_t ring, const MarketDataEvent& e) {
+        ++records;
+        Book& book = books[e.symbolId];
+        if (book.symbol.empty()) {
+            book.symbol.assign(e.symbol, strnlen(e.symbol, sizeof(e.symbol)));
+            book.ring = ring;
+        }
+        switch (e.type) {
+            case 'U':
+                ++updates;
+                if ((e.side != 'B' && e.side != 'S') || (e.orders == 0) != (e.quantity == 0))
+                    problem(book, "bad level update");
+                else if (book.synced)
+                    update(book, e);
+                break;
+            case 'S':
+                if (book.inSnapshot)
+                    problem(book, "snapshot started inside another one");
+                book.inSnapshot = true;
+                book.snapshot.clear();
+                break;
+            case 'L':
+                if (!book.inSnapshot)
+                    problem(book, "snapshot level outside of a snapshot");
+                else
+                    book.snapshot.push_back(e);
+                break;
+            case 'E':
+                if (!book.inSnapshot)
+                    problem(book, "snapshot end without a start");
+                else
+                    endSnapshot(book);
+                book.inSnapshot = false;
+                break;
+            default:
+                problem(book, "unknown record type");
+                break;
+        }
+    }
+
+    // The writer lapped the reader on ring: whatever went by is gone, its books wait for their next snapshot
+    void lapped(size_t ring) {
+        ++laps;
+        for (auto& [id, book] : books)
+            if (book.ring == ring) {
+                book.synced = false;
+                book.inSnapshot = false;
+            }
+    }
+
+    void print() const {
+        std::map<std::string, const Book*> sorted;
+        for (const auto& [id, book] : books)
+            sorted[book.symbol] = &book;
+        for (const auto& [symbol, book] : sorted) {
+            if (!book->synced) {
+                printf("%s not in sync\n", symbol.c_str());
+                continue;
+            }
+            for (const auto& [price, level] : book->bids)
+                printf("%s B %u %llu %u\n", symbol.c_str(), price, (unsigned long long)level.quantity, level.orders);
+            for (const auto& [price, level] : book->asks)
+                printf("%s S %u %llu %u\n", symbol.c_str(), price, (unsigned long long)level.quantity, level.orders);
+        }
+        fflush(stdout);
+        fprintf(stderr, "mdcheck: %llu records, %llu level updates, %llu snapshots checked, %llu problems, %llu laps\n",
+                (unsigned long long)records, (unsigned long long)updates, (unsigned long long)checked,
+                (unsigned long long)problems, (unsigned long long)laps);
+    }
+
+    bool ok() const { return problems == 0; }
+
+private:
+    static void update(Book& book, const MarketDataEvent& e) {
+        Level level{e.quantity, e.orders};
+        if (e.side == 'B') {
+            if (e.orders == 0)
+                book.bids.erase(e.price);
+            else
+                book.bids[e.price] = level;
+        } else {
+            if (e.orders == 0)
+                book.asks.erase(e.price);
+            else
+                book.asks[e.price] = level;
+        }
+    }
+
+    void endSnapshot(Book& book) {
+        std::vector<std::pair<uint32_t, Level>> bids, asks;
+        for (const MarketDataEvent& l : book.snapshot) {
+            auto& side = l.side == 'B' ? bids : asks;
+            if ((l.side != 'B' && l.side != 'S') || l.orders == 0 || l.quantity == 0 || (l.side == 'B' && !asks.empty())) {
+                problem(book, "bad snapshot level");
+                return;
+            }
+            if (!side.empty() && (l.side == 'B' ? l.price >= side.back().first : l.price <= side.back().first)) {
+                problem(book, "snapshot levels out of order");
+                return;
+            }
+            side.push_back({l.price, Level{l.quantity, l.orders}});
+        }
+        if (bids.size() > depth || asks.size() > depth)
+            problem(book, "snapshot deeper than the feed's depth");
+        else if (!bids.empty() && !asks.empty() && bids.front().first >= asks.front().first)
+            problem(book, "snapshot crossed");
+
+        if (book.synced) {
+            ++checked;
+            if (!sameTop(book.bids, bids, book.bidsPartial) || !sameTop(book.asks, asks, book.asksPartial))
+                problem(book, "snapshot disagrees with the level updates");
+        }
+        // In sync from here on, and whatever is known to be incomplete is taken over
+        if (!book.synced || book.bidsPartial)
+            takeOver(book.bids, bids, book.bidsPartial);
+        if (!book.synced || book.asksPartial)
+            takeOver(book.asks, asks, book.asksPartial);
+        book.synced = true;
+    }
+
+    // A side is as deep as the snapshot shows, unless the snapshot was full (or the side was never all seen)
+    template <typename Side>
+    bool sameTop(const Side& side, const std::vector<std::pair<uint32_t, Level>>& snap, bool partial) const {
+        if (partial)
+            return true;
+        size_t n = 0;
+        for (auto it = side.begin(); it != side.end() && n < depth; ++it, ++n)
+            if (n >= snap.size() || it->first != snap[n].first || !(it->second == snap[n].second))
+                return false;
+        return n == snap.size();
+    }
+
+    template <typename Side>
+    void takeOver(Side& side, const std::vector<std::pair<uint32_t, Level>>& snap, bool& partial) const {
+        side.clear();
+        for (const auto& [price, level] : snap)
+            side[price] = level;
+        partial = snap.size() == depth;
+    }
+
+    void problem(const Book& book, const char* what) {
+        ++problems;
+        fprintf(stderr, "mdcheck: %s: %s\n", book.symbol.c_str(), what);
+    }
+
+    uint32_t depth;
+    std::unordered_map<uint32_t, Book> books;
+    uint64_t records = 0;
+    uint64_t updates = 0;
+    uint64_t checked = 0;
+    uint64_t problems = 0;
+    uint64_t laps = 0;
+};
+
+void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s </name> [--idle=<ms>]\n", prog);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    long idleMs = 2000;
+    for (int i = 2; i < argc; ++i) {
+        char* end = nullptr;
+        if (strncmp(argv[i], "--idle=", 7) == 0 && (idleMs = strtol(argv[i] + 7, &end, 10)) > 0 && *end == '\0')
+            continue;
+        usage(argv[0]);
+        return 1;
+    }
+
+    auto idle = std::chrono::milliseconds(idleMs);
+    auto lastRecord = std::chrono::steady_clock::now();
+    // The engine may not have set the segment up yet, give it until the idle time is up
+    std::unique_ptr<MarketDataReader> attached;
+    while (!attached) {
+        try {
+            attached = std::make_unique<MarketDataReader>(argv[1]);
+        } catch (const std::exception& ex) {
+            if (std::chrono::steady_clock::now() - lastRecord >= idle) {
+                fprintf(stderr, "mdcheck: %s\n", ex.what());
+                return 1;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    MarketDataReader& reader = *attached;
+    Checker checker(reader.depth());
+    lastRecord = std::chrono::steady_clock::now();
+    MarketDataEvent e;
+    while (std::chrono::steady_clock::now() - lastRecord < idle) {
+        bool any = false;
+        for (size_t r = 0; r < reader.ringCount(); ++r) {
+            MarketDataReader::Result result;
+            while ((result = reader.poll(r, e)) != MarketDataReader::Result::Empty) {
+                if (result == MarketDataReader::Result::Event)
+                    checker.apply(r, e);
+                else
+                    checker.lapped(r);
+                any = true;
+            }
+        }
+        if (any)
+            lastRecord = std::chrono::steady_clock::now();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    checker.print();
+    return checker.ok() ? 0 : 1;
+}
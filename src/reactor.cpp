@@ -0,0 +1,153 @@
+#include "reactor.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "Affinity.hpp"
+#include "engine.hpp"
+#include "io.hpp"
+#include "CommandParser.hpp"
+
+struct Reactor::Connection {
+    explicit Connection(int fd) : fd(fd) { }
+
+    int fd;
+    RecvBuffer buffer;
+};
+
+Reactor::Reactor(Engine& engine, size_t threads, std::vector<int> cpus)
+    : engine(engine), cpus(std::move(cpus)) {
+    for (size_t i = 0; i < threads; ++i) {
+        auto io = std::make_unique<IoThread>();
+        io->epollFd = epoll_create1(EPOLL_CLOEXEC);
+        io->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (io->epollFd == -1 || io->wakeFd == -1) {
+            perror("[SERVER] reactor");
+            continue;
+        }
+        struct epoll_event ev {};
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;  // nullptr marks the wake fd
+        epoll_ctl(io->epollFd, EPOLL_CTL_ADD, io->wakeFd, &ev);
+        ioThreads.push_back(std::move(io));
+    }
+}
+
+void Reactor::start() {
+    for (size_t i = 0; i < ioThreads.size(); ++i) {
+        IoThread* ioPtr = ioThreads[i].get();
+        int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+        ioPtr->thread = std::thread([this, ioPtr, cpu]() {
+            if (!pinThisThread(cpu))
+                SyncCerr() << "[SERVER] could not pin I/O thread to cpu " << cpu << std::endl;
+            run(*ioPtr);
+        });
+    }
+}
+
+void Reactor::stopAndJoin() {
+    stop = true;
+    for (auto& io : ioThreads) {
+        uint64_t one = 1;
+        if (write(io->wakeFd, &one, sizeof(one)) < 0)
+            perror("[SERVER] reactor wake");
+        if (io->thread.joinable())
+            io->thread.join();
+    }
+}
+
+void Reactor::addConnection(int fd) {
+    if (ioThreads.empty()) {
+        ::close(fd);
+        return;
+    }
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+    IoThread& io = *ioThreads[nextThread.fetch_add(1, std::memory_order_relaxed) % ioThreads.size()];
+    auto* conn = new Connection(fd);
+    struct epoll_event ev {};
+    // Edge triggered: we get one wakeup per burst of data and must read until EAGAIN
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = conn;
+    if (epoll_ctl(io.epollFd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        perror("[SERVER] epoll_ctl");
+        ::close(fd);
+        delete conn;
+    }
+}
+
+void Reactor::close(IoThread& io, Connection* conn) {
+    epoll_ctl(io.epollFd, EPOLL_CTL_DEL, conn->fd, nullptr);
+    ::close(conn->fd);
+    delete conn;
+}
+
+bool Reactor::onReadable(Connection& conn) {
+    ClientCommand cmds[64];
+    while (true) {
+        ssize_t n = read(conn.fd, conn.buffer.writePtr(), conn.buffer.writable());
+        int64_t readTs = engine.readTimestamp();
+        bool eof = false;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+            return false;
+        }
+        if (n == 0) {
+            eof = true;
+            conn.buffer.finish();
+        } else {
+            conn.buffer.commit(n);
+        }
+
+        // Hand every complete line to the engine, the partial tail stays buffered for the next read
+        size_t count;
+        ReadResult res;
+        do {
+            res = conn.buffer.parse(cmds, 64, count);
+            for (size_t i = 0; i < count; ++i) {
+                cmds[i].read_ts = readTs;
+                engine.processClientCommand(cmds[i]);
+            }
+        } while (res == ReadResult::Success && count == 64);
+        if (res == ReadResult::Error) {
+            // Same as the thread per connection mode, a malformed line ends the connection
+            if (conn.buffer.parseError() != ParseError::None)
+                SyncCerr() << "[SERVER] dropping client: " << parseErrorString(conn.buffer.parseError()) << std::endl;
+            return false;
+        }
+        if (eof)
+            return false;
+    }
+}
+
+void Reactor::run(IoThread& io) {
+    struct epoll_event events[256];
+    while (!stop) {
+        int n = epoll_wait(io.epollFd, events, 256, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("[SERVER] epoll_wait");
+            return;
+        }
+        for (int i = 0; i < n; ++i) {
+            auto* conn = static_cast<Connection*>(events[i].data.ptr);
+            if (!conn)
+                continue;  // wake fd, loop condition sees stop
+            // Read first even on hangup, the client may have sent its last lines right before closing
+            if (!onReadable(*conn) || (events[i].events & (EPOLLERR | EPOLLHUP)))
+                close(io, conn);
+        }
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <vector>
+
+class Engine;
+
+// epoll based front end: a small fixed set of I/O threads serves every client connection,
+// instead of one thread per connection (Engine::accept's default).
+//
+// Each I/O thread owns an epoll instance, accepted sockets are made non-blocking and handed to the threads round robin,
+// registered edge-triggered. On readiness a thread reads until EAGAIN, splits the bytes into lines, parses them and hands
+// the commands straight to the engine (and from there to the instrument workers' queues).
+// A connection only ever lives on one I/O thread, so its buffer needs no locking.
+class Reactor {
+public:
+    // I/O thread i is pinned to cpus[i % cpus.size()] (not pinned when empty)
+    Reactor(Engine& engine, size_t ioThreads, std::vector<int> cpus = {});
+    ~Reactor() { stopAndJoin(); }
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+
+    void start();
+    void stopAndJoin();
+
+    // Takes ownership of a connected client socket
+    void addConnection(int fd);
+
+private:
+    struct Connection;
+
+    struct IoThread {
+        int epollFd = -1;
+        int wakeFd = -1;   // eventfd, only used to stop the thread
+        std::thread thread;
+    };
+
+    void run(IoThread& io);
+    // Reads everything available, returns false once the connection should be closed
+    bool onReadable(Connection& conn);
+    void close(IoThread& io, Connection* conn);
+
+    Engine& engine;
+    std::vector<int> cpus;
+    std::vector<std::unique_ptr<IoThread>> ioThreads;
+    std::atomic<size_t> nextThread{0};
+    std::atomic<bool> stop{false};
+};
@@ -0,0 +1,262 @@
+// Offline replay of a captured order file straight into the matching core: no engine, no sockets, no threads.
+//
+// The file is mapped and read in place, either text (the lines ./client sends) or binary (what ./client --binary
+// sends: the 0x01 handshake byte followed by WireCommand frames, see WireProtocol.hpp), told apart by the first byte.
+// Every command goes directly into its instrument's OrderBook on this one thread, cancels and amends find their book
+// through an order id index like the engine's router. The events are the engine's, in command order, and each one is
+// stamped with the sequence number (from 1) of the command that caused it instead of a clock, so the same input
+// always gives byte for byte the same output.
+//
+// Usage: replay <file> [--output=text|binary|none] [--ladder=<base>:<tick>:<levels>]
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "CommandParser.hpp"
+#include "OrderBook.hpp"
+#include "OrderIndex.hpp"
+#include "OutputPublisher.hpp"
+#include "SymbolTable.hpp"
+#include "WireProtocol.hpp"
+
+namespace {
+
+enum class Format { Text, Binary, None };
+
+// Buffered output on fd 1, written out in large chunks
+class Output {
+public:
+    explicit Output(Format format) : format(format) { buf.resize(FlushBytes + 256); }
+    ~Output() { flush(); }
+
+    void event(const OutputEvent& e) {
+        ++events;
+        if (format == Format::Text)
+            used += OutputPublisher::formatText(e, buf.data() + used);
+        else if (format == Format::Binary) {
+            memcpy(buf.data() + used, &e, sizeof(e));
+            used += sizeof(e);
+        }
+        if (used >= FlushBytes)
+            flush();
+    }
+
+    void flush() {
+        const char* p = buf.data();
+        while (used > 0) {
+            ssize_t n = write(1, p, used);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                perror("replay: write");
+                exit(1);
+            }
+            p += n;
+            used -= static_cast<size_t>(n);
+        }
+    }
+
+    uint64_t events = 0;
+
+private:
+    static constexpr size_t FlushBytes = 1 << 20;
+
+    Format format;
+    std::vector<char> buf;
+    size_t used = 0;
+};
+
+// Same events as the engine's, order ids of orders that are gone leave the index
+struct ReplaySink {
+    Output& out;
+    OrderIndex& routes;
+    uint32_t index;
+
+    void OrderAdded(uint32_t id, const char* symbol, uint32_t price, uint32_t count, bool is_sell_side, int64_t ts) {
+        out.event(OutputEvent::added(id, symbol, price, count, is_sell_side, ts));
+    }
+    void OrderExecuted(uint32_t resting_id, uint32_t new_id, uint32_t execution_id, uint32_t price, uint32_t count, int64_t ts) {
+        out.event(OutputEvent::executed(resting_id, new_id, execution_id, price, count, ts));
+    }
+    void OrderDeleted(uint32_t id, bool cancel_accepted, int64_t ts) { out.event(OutputEvent::deleted(id, cancel_accepted, ts)); }
+    void OrderAmended(uint32_t id, bool accepted, uint32_t price, uint32_t count, int64_t ts) {
+        out.event(OutputEvent::amended(id, accepted, price, count, ts));
+    }
+    void OrderRemoved(uint32_t id) { routes.erase(id, index); }
+    void LevelChanged(bool, uint32_t, uint64_t, uint32_t, int64_t) { }
+};
+
+struct Instrument {
+    Instrument(const std::string& symbol, Output& out, OrderIndex& routes, uint32_t index, const std::optional<LadderConfig>& ladder)
+        : sink{out, routes, index}, book(symbol, sink, ladder) { }
+
+    ReplaySink sink;
+    OrderBook<ReplaySink> book;
+};
+
+class Replay {
+public:
+    Replay(Format format, std::optional<LadderConfig> ladder) : out(format), ladder(ladder) { }
+
+    void apply(const ClientCommand& cmd) {
+        int64_t ts = static_cast<int64_t>(++commands);
+        if (cmd.type == input_cancel || cmd.type == input_amend) {
+            // Like the engine's router: an order id that isn't resting anywhere is rejected without a book
+            OrderHandle at = routes.find(cmd.order_id);
+            if (at != NullOrder)
+                instruments[at]->book.apply(cmd, ts);
+            else if (cmd.type == input_cancel)
+                out.event(OutputEvent::deleted(cmd.order_id, false, ts));
+            else
+                out.event(OutputEvent::amended(cmd.order_id, false, cmd.price, cmd.count, ts));
+            return;
+        }
+        Instrument* instr = symbols.find(SymbolTable<Instrument>::pack(cmd.instrument));
+        if (!instr)
+            instr = add(cmd.instrument);
+        routes.insert(cmd.order_id, instr->sink.index);
+        instr->book.apply(cmd, ts);
+    }
+
+    uint64_t commands = 0;
+    Output out;
+
+private:
+    Instrument* add(const char* symbol) {
+        uint32_t index = static_cast<uint32_t>(instruments.size());
+        instruments.push_back(std::make_unique<Instrument>(symbol, out, routes, index, ladder));
+        symbols.insert(SymbolTable<Instrument>::pack(symbol), instruments.back().get());
+        return instruments.back().get();
+    }
+
+    std::optional<LadderConfig> ladder;
+    OrderIndex routes{1 << 16};
+    SymbolTable<Instrument> symbols;
+    std::vector<std::unique_ptr<Instrument>> instruments;
+};
+
+// Lines are copied out of the (read only) mapping to be NUL terminated, the parser wants that
+constexpr size_t MaxLine = 256;
+
+bool replayText(const char* p, const char* end, Replay& replay) {
+    char line[MaxLine];
+    ClientCommand cmd;
+    uint64_t lineNo = 0;
+    while (p < end) {
+        ++lineNo;
+        const char* nl = findNewline(const_cast<char*>(p), const_cast<char*>(end));
+        size_t len = (nl ? nl : end) - p;
+        if (len >= MaxLine) {
+            fprintf(stderr, "replay: line %llu is too long\n", (unsigned long long)lineNo);
+            return false;
+        }
+        memcpy(line, p, len);
+        line[len] = '\0';
+        p += len + 1;
+        if (isIgnoredLine(line))
+            continue;
+        ParseError err = parseCommand(line, cmd);
+        if (err != ParseError::None) {
+            fprintf(stderr, "replay: line %llu: %s\n", (unsigned long long)lineNo, parseErrorString(err));
+            return false;
+        }
+        replay.apply(cmd);
+    }
+    return true;
+}
+
+// begin: just past the handshake byte
+bool replayBinary(const char* begin, const char* end, Replay& replay) {
+    const char* p = begin;
+    ClientCommand cmd;
+    ParseError err = ParseError::None;
+    while (p < end) {
+        ptrdiff_t n = decodeCommand(p, end - p, cmd, err);
+        if (n <= 0) {
+            fprintf(stderr, "replay: frame at byte %lld: %s\n", (long long)(p - begin + 1),
+                    n == 0 ? "cut short" : parseErrorString(err));
+            return false;
+        }
+        p += n;
+        replay.apply(cmd);
+    }
+    return true;
+}
+
+bool parseLadder(const char* spec, LadderConfig& ladder) {
+    int consumed = 0;
+    return sscanf(spec, "%u:%u:%u%n", &ladder.base, &ladder.tick, &ladder.levels, &consumed) == 3
+        && spec[consumed] == '\0' && PriceLadder::valid(ladder);
+}
+
+void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s <file> [--output=text|binary|none] [--ladder=<base>:<tick>:<levels>]\n", prog);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    Format format = Format::Text;
+    std::optional<LadderConfig> ladder;
+    for (int i = 2; i < argc; ++i) {
+        LadderConfig l;
+        if (strcmp(argv[i], "--output=text") == 0)
+            format = Format::Text;
+        else if (strcmp(argv[i], "--output=binary") == 0)
+            format = Format::Binary;
+        else if (strcmp(argv[i], "--output=none") == 0)
+            format = Format::None;
+        else if (strncmp(argv[i], "--ladder=", 9) == 0 && parseLadder(argv[i] + 9, l))
+            ladder = l;
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    size_t bytes = static_cast<size_t>(st.st_size);
+    const char* data = "";
+    if (bytes > 0) {
+        void* map = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        if (map == MAP_FAILED) {
+            perror("replay: mmap");
+            return 1;
+        }
+        madvise(map, bytes, MADV_SEQUENTIAL);
+        data = static_cast<const char*>(map);
+    }
+    close(fd);
+
+    Replay replay(format, ladder);
+    auto started = std::chrono::steady_clock::now();
+    bool ok = bytes > 0 && data[0] == BinaryHandshake ? replayBinary(data + 1, data + bytes, replay)
+                                                       : replayText(data, data + bytes, replay);
+    replay.out.flush();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    fprintf(stderr, "replay: %llu commands, %llu events in %.3f s (%.2f M commands/s)\n",
+            (unsigned long long)replay.commands, (unsigned long long)replay.out.events, secs,
+            secs > 0 ? replay.commands / secs / 1e6 : 0.0);
+    return ok ? 0 : 1;
+}